@@ -35,6 +35,29 @@
 
 #include <Rcpp.h>
 #include <array>
+#include <map>
+#include <cstring>
+#include <cstdarg>
+#include <cstdio>
+#include <sstream>
+#include <chrono>
+#include "lsoda_partition.h"
+#include "lsoda_metrics.h"
+
+/*
+  Loops over the states in the vector kernels of the solver, which run
+  on threads_ OpenMP threads when vpar_ is set ( LSODA::set_threads() ).
+*/
+#ifdef _OPENMP
+#define LSODA_PRAGMA(x) _Pragma(#x)
+#define LSODA_VECTOR_FOR \
+  LSODA_PRAGMA(omp parallel for schedule(static) if(vpar_) num_threads(threads_))
+#define LSODA_VECTOR_REDUCE(op, var) \
+  LSODA_PRAGMA(omp parallel for schedule(static) if(vpar_) num_threads(threads_) reduction(op:var))
+#else
+#define LSODA_VECTOR_FOR
+#define LSODA_VECTOR_REDUCE(op, var)
+#endif
 
 namespace LSODA {
 
@@ -52,9 +75,153 @@ namespace LSODA {
   /* ----------------------------------------------------------------------------*/
   typedef void (*LSODA_ODE_SYSTEM_TYPE)(double t, double *y, double *dydt, void *);
 
+  /*
+    Type of a user-supplied full Jacobian (jt = 1): pd[i + neq * j] is to be
+    set to df_i / dy_j, with zero entries left alone (pd is zeroed first).
+  */
+  typedef void (*LSODA_JAC_TYPE)(double t, double *y, double *pd, void *);
+
   constexpr double ETA = std::numeric_limits<double>::epsilon();
   // #define ETA 2.2204460492503131e-16
-  
+
+  // largest window of Anderson acceleration ( LSODA::set_anderson() )
+  constexpr size_t ANDERSON_MAX = 5;
+
+  /*
+    Diagnostics of the solver go to the R console, which only the R thread
+    may use.  A thread that sets capture() ( a worker of a SolverPool )
+    has them appended to its own buffer instead.
+  */
+  inline std::ostringstream *&capture() {
+    static thread_local std::ostringstream *buf = nullptr;
+    return buf;
+  }
+
+  inline std::ostream &errs() {
+    if(capture() != nullptr)
+      return *capture();
+    return Rcpp::Rcerr;
+  }
+
+  inline void eprintf(const char *fmt, ...) {
+    char msg[512];
+    va_list args;
+    va_start(args, fmt);
+    std::vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    if(capture() != nullptr)
+      *capture() << msg;
+    else
+      REprintf("%s", msg);
+  }
+
+  /*
+    Dense output: the Nordsieck arrays of the steps taken, appended by
+    LSODA::dense_append() after each step, from which the states can be
+    interpolated anywhere in the range integrated, as intdy does for the
+    last step.  Step s covers [tn - hu, tn], and holds the nq + 1 rows
+    yh_[1..nq+1] of neq values each.
+  */
+  class DenseOutput {
+  public:
+    size_t neq = 0;
+
+    void append(double tn, double h, double hu, size_t nq,
+		const std::vector<std::vector<double>> &yh)
+    {
+      tn_.push_back(tn);
+      h_.push_back(h);
+      hu_.push_back(hu);
+      nq_.push_back(nq);
+      offset_.push_back(yh_.size());
+      for(size_t r = 1; r <= nq + 1; r++)
+	yh_.insert(yh_.end(), yh[r].begin() + 1, yh[r].begin() + 1 + neq);
+    }
+
+    size_t size() const
+    {
+      return tn_.size();
+    }
+
+    /*
+      The index of the step covering t, or size() if there is none.
+    */
+    size_t locate(double t) const
+    {
+      if(tn_.empty())
+	return 0;
+      double dir = (hu_[0] >= 0.) ? 1. : -1.;
+      size_t lo = 0, hi = tn_.size();
+      while(lo < hi) {
+	size_t mid = (lo + hi) / 2;
+	if((tn_[mid] - t) * dir < 0.)
+	  lo = mid + 1;
+	else
+	  hi = mid;
+      }
+      if(lo == tn_.size())
+	return lo;
+      double tfuzz = 100. * ETA * (std::abs(tn_[lo]) + std::abs(hu_[lo]));
+      if((t - (tn_[lo] - hu_[lo])) * dir < -tfuzz)
+	return tn_.size();
+      return lo;
+    }
+
+    /*
+      Component j ( 0-based ) at t in step s, as intdy with k = 0.
+    */
+    double value(size_t s, double t, size_t j) const
+    {
+      const double *yh = &yh_[offset_[s]];
+      double u = (t - tn_[s]) / h_[s], v = yh[nq_[s] * neq + j];
+      for(size_t r = nq_[s]; r >= 1; r--)
+	v = yh[(r - 1) * neq + j] + u * v;
+      return v;
+    }
+
+  private:
+    std::vector<double> tn_, h_, hu_, yh_;
+    std::vector<size_t> nq_, offset_;
+  };
+
+  /*
+    One attempted step of stoda, as recorded by LSODA::set_trace(): the
+    time t = told + h aimed for, the step size h, order and method (1 for
+    Adams, 2 for BDF) used, the number of corrector iterations, whether
+    the iteration matrix was formed anew ( jacobian = 0 if reused, 1 from
+    a new Jacobian, 2 from a Broyden updated one ), and the outcome ( 0
+    accepted, 1 error test failure, 2 convergence failure ).
+  */
+  struct TraceEntry {
+    double t, h;
+    int order, method, iterations, jacobian, outcome;
+  };
+
+  /*
+    An accepted step, as recorded by LSODA::set_record(): the time t
+    reached, and the step size h, order and method ( 1 for Adams, 2 for
+    BDF ) used.  LSODA::set_replay() takes the same steps again.
+  */
+  struct StepRecord {
+    double t, h;
+    int order, method;
+  };
+
+  /*
+    The heuristic constants of stoda and correction, with the values of
+    the original lsoda ( LSODA::set_heuristics() ): the iteration matrix
+    is formed anew when h_ * el[1] changes by more than a fraction ccmax,
+    or at least every msbp steps; the corrector takes at most maxcor
+    iterations; the step fails after mxncf convergence failures; and a
+    switch from Adams to BDF needs a step size ratio of at least ratio
+    ( and from BDF to Adams, of 5 / ratio ).
+  */
+  struct Heuristics {
+    double ccmax = 0.3;
+    size_t msbp = 20, maxcor = 3, mxncf = 10;
+    double ratio = 5.;
+  };
+
   class LSODA {
 
   public:
@@ -82,7 +249,7 @@ namespace LSODA {
     size_t idamax1(const std::vector<double> &dx, const size_t n, const size_t offset = 0)
     {
 
-      size_t v = 0, vmax = 0;
+      double v = 0, vmax = 0;
       size_t idmax = 1;
       for(size_t i = 1; i <= n; i++) {
 	v = std::abs(dx[i + offset]);
@@ -241,11 +408,128 @@ namespace LSODA {
 	*info = n;
     }
 
+    /*
+      See LINPACK documentation. The band matrix is stored by columns, with
+      abd[j][i - j + ml + mu + 1] holding element (i, j), so that rows 1 to
+      ml of each column are workspace for fill-in.
+    */
+    void dgbfa(std::vector<std::vector<double>> &abd, const size_t n, const size_t ml,
+	       const size_t mu, std::vector<int> &ipvt, size_t *const info)
+    {
+      size_t i = 0, j = 0, k = 0, l = 0, lm = 0, m = 0, mm = 0, jz = 0, ju = 0;
+      double t = 0.0;
+
+      m     = ml + mu + 1;
+      *info = 0;
+      /*
+	Zero initial fill-in columns.
+      */
+      for(jz = mu + 2; jz < std::min(n, m); jz++)
+	for(i = m + 1 - jz; i <= ml; i++)
+	  abd[jz][i] = 0.;
+      jz = std::max(std::min(n, m), (size_t)1) - 1;
+      ju = 0;
+
+      /* Gaussian elimination with partial pivoting.   */
+
+      for(k = 1; k <= n - 1; k++) {
+	/*
+	  Zero next fill-in column.
+	*/
+	jz++;
+	if(jz <= n)
+	  for(i = 1; i <= ml; i++)
+	    abd[jz][i] = 0.;
+	/*
+	  Find l = pivot index.
+	*/
+	lm      = std::min(ml, n - k);
+	l       = idamax1(abd[k], lm + 1, m - 1) + m - 1;
+	ipvt[k] = (int)(l + k - m);
+	/*
+	  Zero pivot implies this column already triangularized.
+	*/
+	if(abd[k][l] == 0.) {
+	  *info = k;
+	  continue;
+	}
+	/*
+	  Interchange if necessary.
+	*/
+	if(l != m) {
+	  t         = abd[k][l];
+	  abd[k][l] = abd[k][m];
+	  abd[k][m] = t;
+	}
+	/*
+	  Compute multipliers.
+	*/
+	t = -1. / abd[k][m];
+	for(i = m + 1; i <= m + lm; i++)
+	  abd[k][i] *= t;
+	/*
+	  Row elimination with column indexing.
+	*/
+	ju = std::min(std::max(ju, mu + (size_t)ipvt[k]), n);
+	mm = m;
+	for(j = k + 1; j <= ju; j++) {
+	  l--;
+	  mm--;
+	  t = abd[j][l];
+	  if(l != mm) {
+	    abd[j][l]  = abd[j][mm];
+	    abd[j][mm] = t;
+	  }
+	  daxpy1(t, abd[k], abd[j], lm, m, mm);
+	}
+      } /* end k-loop  */
+
+      ipvt[n] = n;
+      if(abd[n][m] == 0.)
+	*info = n;
+    }
+
+    // See LINPACK documentation. Solves a * x = b with the factors from dgbfa.
+    void dgbsl(const std::vector<std::vector<double>> &abd, const size_t n, const size_t ml,
+	       const size_t mu, std::vector<int> &ipvt, std::vector<double> &b)
+    {
+      size_t k = 0, l = 0, la = 0, lb = 0, lm = 0, m = 0;
+      double t = 0.0;
+
+      m = mu + ml + 1;
+      /*
+	First solve L * y = b.
+      */
+      if(ml != 0) {
+	for(k = 1; k <= n - 1; k++) {
+	  lm = std::min(ml, n - k);
+	  l  = ipvt[k];
+	  t  = b[l];
+	  if(l != k) {
+	    b[l] = b[k];
+	    b[k] = t;
+	  }
+	  daxpy1(t, abd[k], b, lm, m, k);
+	}
+      }
+      /*
+	Now solve U * x = y.
+      */
+      for(k = n; k >= 1; k--) {
+	b[k] /= abd[k][m];
+	lm = std::min(k, m) - 1;
+	la = m - lm;
+	lb = k - lm;
+	t  = -b[k];
+	daxpy1(t, abd[k], b, lm, la - 1, lb - 1);
+      }
+    }
+
     /* Terminate lsoda due to illegal input. */
     void terminate(int *istate)
     {
       if(illin == 5)
-	Rcpp::Rcerr << "[lsoda] repeated occurrence of illegal input. run aborted.. "
+	errs() << "[lsoda] repeated occurrence of illegal input. run aborted.. "
 	  "apparent infinite loop."
 		    << "\n";
       else {
@@ -318,17 +602,17 @@ namespace LSODA {
       */
 
       if(*istate < 1 || *istate > 3) {
-	Rcpp::Rcerr << "[lsoda] illegal istate = " << *istate << "\n";
+	errs() << "[lsoda] illegal istate = " << *istate << "\n";
 	terminate(istate);
 	return;
       }
       if(itask < 1 || itask > 5) {
-	Rcpp::Rcerr << "[lsoda] illegal itask =" << itask << "\n";
+	errs() << "[lsoda] illegal itask =" << itask << "\n";
 	terminate(istate);
 	return;
       }
       if(init == 0 && (*istate == 2 || *istate == 3)) {
-	Rcpp::Rcerr << "[lsoda] istate > 1 but lsoda not initialized" << "\n";
+	errs() << "[lsoda] istate > 1 but lsoda not initialized" << "\n";
 	terminate(istate);
 	return;
       }
@@ -346,42 +630,68 @@ namespace LSODA {
       if(*istate == 1 || *istate == 3) {
 	ntrep = 0;
 	if(neq <= 0) {
-	  Rcpp::Rcerr << "[lsoda] neq = " << neq << " is less than 1." << "\n";
+	  errs() << "[lsoda] neq = " << neq << " is less than 1." << "\n";
 	  terminate(istate);
 	  return;
 	}
 	if(*istate == 3 && neq > n) {
-	  Rcpp::Rcerr << "[lsoda] istate = 3 and neq increased" << "\n";
+	  errs() << "[lsoda] istate = 3 and neq increased" << "\n";
 	  terminate(istate);
 	  return;
 	}
 	n = neq;
 	if(itol_ < 1 || itol_ > 4) {
-	  Rcpp::Rcerr << "[lsoda] itol = " << itol_ << " illegal" << "\n";
+	  errs() << "[lsoda] itol = " << itol_ << " illegal" << "\n";
 	  terminate(istate);
 	  return;
 	}
 	if(iopt < 0 || iopt > 1) {
-	  Rcpp::Rcerr << "[lsoda] iopt = " << iopt << " illegal" << "\n";
+	  errs() << "[lsoda] iopt = " << iopt << " illegal" << "\n";
 	  terminate(istate);
 	  return;
 	}
-	if(jt == 3 || jt < 1 || jt > 5) {
-	  Rcpp::Rcerr << "[lsoda] jt = " << jt << " illegal" << "\n";
+	if(jt == 3 || jt < 1 || jt > 7) {
+	  errs() << "[lsoda] jt = " << jt << " illegal" << "\n";
 	  terminate(istate);
 	  return;
 	}
 	jtyp = jt;
-	if(jt > 2) {
+	if(!mass_.empty()) {
+	  if(mass_.size() != n + 1) {
+	    errs() << "[lsoda] mass has length " << mass_.size() - 1
+			<< " but neq = " << n << "\n";
+	    terminate(istate);
+	    return;
+	  }
+	  if(jt == 4) {
+	    errs() << "[lsoda] a mass matrix requires jt = 1, 2, 5, 6 or 7" << "\n";
+	    terminate(istate);
+	    return;
+	  }
+	}
+	if(jt == 1 && jacfn_ == nullptr) {
+	  errs() << "[lsoda] jt = 1 requires a Jacobian function" << "\n";
+	  terminate(istate);
+	  return;
+	}
+	if(jt == 4 || jt == 5) {
 	  ml = iworks[0];
 	  mu = iworks[1];
 	  if(ml >= n) {
-	    Rcpp::Rcerr << "[lsoda] ml = " << ml << " not between 1 and neq" << "\n";
+	    errs() << "[lsoda] ml = " << ml << " not between 1 and neq" << "\n";
 	    terminate(istate);
 	    return;
 	  }
 	  if(mu >= n) {
-	    Rcpp::Rcerr << "[lsoda] mu = " << mu << " not between 1 and neq" << "\n";
+	    errs() << "[lsoda] mu = " << mu << " not between 1 and neq" << "\n";
+	    terminate(istate);
+	    return;
+	  }
+	}
+	if(jt == 7) {
+	  mb = iworks[0];
+	  if(mb < 1 || n % mb != 0) {
+	    errs() << "[lsoda] block size = " << mb << " does not divide neq" << "\n";
 	    terminate(istate);
 	    return;
 	  }
@@ -407,7 +717,7 @@ namespace LSODA {
 	  {
 	    ixpr = iworks[2];
 	    if(ixpr > 1) {
-	      Rcpp::Rcerr << "[lsoda] ixpr = " << ixpr << " is illegal" << "\n";
+	      errs() << "[lsoda] ixpr = " << ixpr << " is illegal" << "\n";
 	      terminate(istate);
 	      return;
 	    }
@@ -434,7 +744,7 @@ namespace LSODA {
 	      mxords = std::min(mxords, mord[1]);
 
 	      if((tout - *t) * h0 < 0.) {
-		Rcpp::Rcerr << "[lsoda] tout = " << tout << " behind t = " << *t
+		errs() << "[lsoda] tout = " << tout << " behind t = " << *t
 			    << ". integration direction is given by " << h0 << "\n";
 		terminate(istate);
 		return;
@@ -442,7 +752,7 @@ namespace LSODA {
 	    } /* end if ( *istate == 1 )  */
 	    hmax = rworks[2];
 	    if(hmax < 0.) {
-	      Rcpp::Rcerr << "[lsoda] hmax < 0." << "\n";
+	      errs() << "[lsoda] hmax < 0." << "\n";
 	      terminate(istate);
 	      return;
 	    }
@@ -452,14 +762,14 @@ namespace LSODA {
 
 	    hmin = rworks[3];
 	    if(hmin < 0.) {
-	      Rcpp::Rcerr << "[lsoda] hmin < 0." << "\n";
+	      errs() << "[lsoda] hmin < 0." << "\n";
 	      terminate(istate);
 	      return;
 	    }
 	  } /* end else   */ /* end iopt = 1   */
       }                      /* end if ( *istate == 1 || *istate == 3 )   */
       /*
-	If *istate = 1, meth_ is initialized to 1.
+	If *istate = 1, meth_ is initialized to 1, or to 2 (bdf) for a DAE.
 
 	Also allocate memory for yh_, wm_, ewt, savf, acor, ipvt.
       */
@@ -469,17 +779,41 @@ namespace LSODA {
 	  Hence this section is not executed by *istate = 3.
 	*/
 	sqrteta = sqrt(ETA);
-	meth_   = 1;
+	meth_   = mass_.empty() ? 1 : 2;
 
 	nyh   = n;
 	lenyh = 1 + std::max(mxordn, mxords);
-
-	yh_.resize(lenyh + 1, std::vector<double>(nyh + 1, 0.0));
-	wm_.resize(nyh + 1, std::vector<double>(nyh + 1, 0.0));
+	vpar_ = threads_ > 1 && n >= vmin_;
+
+	// the rows too, for a solver reused with another neq
+	yh_.resize(lenyh + 1);
+	for(int i = 0; i <= lenyh; i++)
+	  yh_[i].resize(nyh + 1, 0.0);
+	// the pattern and groups of jt = 6 are only set by jacdetect()
+	if(jtyp != 6) {
+	  jcolptr_.clear();
+	  jrowind_.clear();
+	  jgptr_.clear();
+	  jgcol_.clear();
+	}
+	jacalloc();
 	ewt.resize(1 + nyh, 0);
 	savf.resize(1 + nyh, 0);
 	acor.resize(nyh + 1, 0.0);
 	ipvt.resize(nyh + 1, 0.0);
+	if(anderson_ > 0) {
+	  andg_.assign(anderson_, std::vector<double>(nyh + 1, 0.0));
+	  andr_.assign(anderson_, std::vector<double>(nyh + 1, 0.0));
+	  andgp_.assign(nyh + 1, 0.0);
+	  andrp_.assign(nyh + 1, 0.0);
+	}
+
+	/* The states interpolated by intdy: all, unless only states are selected.  */
+	iout_.clear();
+	for(size_t k = 0; k < keep_.size() && keep_[k] < n; k++)
+	  iout_.push_back(keep_[k] + 1);
+	if(iout_.size() < keep_.size())
+	  iout_.clear();
       }
       /*
 	Check rtol and atol for legality.
@@ -493,12 +827,12 @@ namespace LSODA {
 	  if(itol_ == 2 || itol_ == 4)
 	    atoli = atol_[i];
 	  if(rtoli < 0.) {
-	    REprintf("[lsoda] rtol = %g is less than 0.\n", rtoli);
+	    eprintf("[lsoda] rtol = %g is less than 0.\n", rtoli);
 	    terminate(istate);
 	    return;
 	  }
 	  if(atoli < 0.) {
-	    REprintf("[lsoda] atol = %g is less than 0.\n", atoli);
+	    eprintf("[lsoda] atol = %g is less than 0.\n", atoli);
 	    terminate(istate);
 	    return;
 	  }
@@ -519,11 +853,11 @@ namespace LSODA {
       if(*istate == 1) {
 	tn_    = *t;
 	tsw    = *t;
-	maxord = mxordn;
+	maxord = (meth_ == 2) ? mxords : mxordn;
 	if(itask == 4 || itask == 5) {
 	  tcrit = rworks[0];
 	  if((tcrit - tout) * (tout - *t) < 0.) {
-	    REprintf("[lsoda] itask = 4 or 5 and tcrit behind tout\n");
+	    eprintf("[lsoda] itask = 4 or 5 and tcrit behind tout\n");
 	    terminate(istate);
 	    return;
 	  }
@@ -535,15 +869,21 @@ namespace LSODA {
 	nhnil  = 0;
 	nst    = 0;
 	nje    = 0;
+	nbu    = 0;
+	nsw_   = 0;
+	ntrace_ = 0;
+	rpos_  = 0;
+	nrp_   = 0;
+	steps_.clear();
 	nslast = 0;
 	hu     = 0.;
 	nqu    = 0;
 	mused  = 0;
-	miter  = 0;
-	ccmax  = 0.3;
-	maxcor = 3;
-	msbp   = 20;
-	mxncf  = 10;
+	miter  = (meth_ == 2) ? jtyp : 0;
+	ccmax  = heur_.ccmax;
+	maxcor = heur_.maxcor;
+	msbp   = heur_.msbp;
+	mxncf  = heur_.mxncf;
 
 	/* Initial call to f.  */
 	if(!((int)yh_.size() == lenyh + 1)) Rcpp::stop("(int)yh_.size() != lenyh + 1");
@@ -551,6 +891,7 @@ namespace LSODA {
 
 	(*f)(*t, &y[1], &yh_[2][1], _data);
 	nfe = 1;
+	massscale(yh_[2], 1.);
 
 	/* Load the initial value vector in yh_.  */
 	for(size_t i = 1; i <= n; i++)
@@ -562,11 +903,24 @@ namespace LSODA {
 	ewset(y);
 	for(size_t i = 1; i <= n; i++) {
 	  if(ewt[i] <= 0.) {
-	    Rcpp::Rcerr << "[lsoda] ewt[" << i << "] = " << ewt[i] << " <= 0.\n" << "\n";
+	    errs() << "[lsoda] ewt[" << i << "] = " << ewt[i] << " <= 0.\n" << "\n";
 	    terminate2(y, t);
 	    return;
 	  }
+	}
+	LSODA_VECTOR_FOR
+	for(size_t i = 1; i <= n; i++)
 	  ewt[i] = 1. / ewt[i];
+
+	/*
+	  If jt = 6, probe f for the Jacobian structure, and set jtyp
+	  accordingly before the stiff method can be selected.
+	*/
+	if(jtyp == 6) {
+	  jacdetect(f, y, _data);
+	  jacalloc();
+	  if(miter != 0)
+	    miter = jtyp;
 	}
 
 	/*
@@ -593,7 +947,7 @@ namespace LSODA {
 	  tdist = std::abs(tout - *t);
 	  w0    = std::max(std::abs(*t), std::abs(tout));
 	  if(tdist < 2. * ETA * w0) {
-	    REprintf("[lsoda] tout too close to t to start integration\n ");
+	    eprintf("[lsoda] tout too close to t to start integration\n ");
 	    terminate(istate);
 	    return;
 	  }
@@ -615,8 +969,12 @@ namespace LSODA {
 	  tol = std::max(tol, 100. * ETA);
 	  tol = std::min(tol, 0.001);
 	  sum = vmnorm(n, yh_[2], ewt);
-	  sum = 1. / (tol * w0 * w0) + tol * sum * sum;
-	  h0  = 1. / sqrt(sum);
+	  if(h0method_ == 2)
+	    h0 = initialstep(f, y, *t, tout, sum, _data);
+	  else {
+	    sum = 1. / (tol * w0 * w0) + tol * sum * sum;
+	    h0  = 1. / sqrt(sum);
+	  }
 	  h0  = std::min(h0, tdist);
 	  // h0  = h0 * ((tout - *t >= 0.) ? 1. : -1.);
 	  h0 = sign(h0, tout - *t);
@@ -647,7 +1005,7 @@ namespace LSODA {
 	  if((tn_ - tout) * h_ >= 0.) {
 	    intdy(tout, 0, y, &iflag);
 	    if(iflag != 0) {
-	      REprintf(
+	      eprintf(
 		       "[lsoda] trouble from intdy, itask = %d, tout = %g\n", itask,
 		       tout);
 	      terminate(istate);
@@ -664,7 +1022,7 @@ namespace LSODA {
 	case 3:
 	  tp = tn_ - hu * (1. + 100. * ETA);
 	  if((tp - tout) * h_ > 0.) {
-	    REprintf("[lsoda] itask = %d and tout behind tcur - hu\n", itask);
+	    eprintf("[lsoda] itask = %d and tout behind tcur - hu\n", itask);
 	    terminate(istate);
 	    return;
 	  }
@@ -675,19 +1033,19 @@ namespace LSODA {
 	case 4:
 	  tcrit = rworks[0];
 	  if((tn_ - tcrit) * h_ > 0.) {
-	    REprintf("[lsoda] itask = 4 or 5 and tcrit behind tcur\n");
+	    eprintf("[lsoda] itask = 4 or 5 and tcrit behind tcur\n");
 	    terminate(istate);
 	    return;
 	  }
 	  if((tcrit - tout) * h_ < 0.) {
-	    REprintf("[lsoda] itask = 4 or 5 and tcrit behind tout\n");
+	    eprintf("[lsoda] itask = 4 or 5 and tcrit behind tout\n");
 	    terminate(istate);
 	    return;
 	  }
 	  if((tn_ - tout) * h_ >= 0.) {
 	    intdy(tout, 0, y, &iflag);
 	    if(iflag != 0) {
-	      REprintf("[lsoda] trouble from intdy, itask = %d, tout = %g\n", itask,
+	      eprintf("[lsoda] trouble from intdy, itask = %d, tout = %g\n", itask,
 		       tout);
 	      terminate(istate);
 	      return;
@@ -702,7 +1060,7 @@ namespace LSODA {
 	  if(itask == 5) {
 	    tcrit = rworks[0];
 	    if((tn_ - tcrit) * h_ > 0.) {
-	      REprintf("[lsoda] itask = 4 or 5 and tcrit behind tcur\n");
+	      eprintf("[lsoda] itask = 4 or 5 and tcrit behind tcur\n");
 	      terminate(istate);
 	      return;
 	    }
@@ -737,7 +1095,7 @@ namespace LSODA {
       while(1) {
 	if(*istate != 1 || nst != 0) {
 	  if((nst - nslast) >= mxstep) {
-	    Rcpp::Rcerr << "[lsoda] " << mxstep << " steps taken before reaching tout"
+	    errs() << "[lsoda] " << mxstep << " steps taken before reaching tout"
 			<< "\n";
 	    *istate = -1;
 	    terminate2(y, t);
@@ -747,27 +1105,29 @@ namespace LSODA {
 	  ewset(yh_[1]);
 	  for(size_t i = 1; i <= n; i++) {
 	    if(ewt[i] <= 0.) {
-	      Rcpp::Rcerr << "[lsoda] ewt[" << i << "] = " << ewt[i] << " <= 0." << "\n";
+	      errs() << "[lsoda] ewt[" << i << "] = " << ewt[i] << " <= 0." << "\n";
 	      *istate = -6;
 	      terminate2(y, t);
 	      return;
 	    }
-	    ewt[i] = 1. / ewt[i];
 	  }
+	  LSODA_VECTOR_FOR
+	  for(size_t i = 1; i <= n; i++)
+	    ewt[i] = 1. / ewt[i];
 	}
 	tolsf = ETA * vmnorm(n, yh_[1], ewt);
 	if(tolsf > 1.0) {
 	  tolsf = tolsf * 2.;
 	  if(nst == 0) {
-	    REprintf("lsoda -- at start of problem, too much accuracy\n");
-	    REprintf("         requested for precision of machine,\n");
-	    REprintf("         suggested scaling factor = %g\n", tolsf);
+	    eprintf("lsoda -- at start of problem, too much accuracy\n");
+	    eprintf("         requested for precision of machine,\n");
+	    eprintf("         suggested scaling factor = %g\n", tolsf);
 	    terminate(istate);
 	    return;
 	  }
-	  REprintf("lsoda -- at t = %g, too much accuracy requested\n", *t);
-	  REprintf("         for precision of machine, suggested\n");
-	  REprintf("         scaling factor = %g\n", tolsf);
+	  eprintf("lsoda -- at t = %g, too much accuracy requested\n", *t);
+	  eprintf("         for precision of machine, suggested\n");
+	  eprintf("         scaling factor = %g\n", tolsf);
 	  *istate = -2;
 	  terminate2(y, t);
 	  return;
@@ -776,12 +1136,12 @@ namespace LSODA {
 	if((tn_ + h_) == tn_) {
 	  nhnil++;
 	  if(nhnil <= mxhnil) {
-	    REprintf("lsoda -- warning..internal t = %g and h_ = %g are\n",
+	    eprintf("lsoda -- warning..internal t = %g and h_ = %g are\n",
 		     tn_, h_);
-	    REprintf("         such that in the machine, t + h_ = t on the next step\n");
-	    REprintf("         solver will continue anyway.\n");
+	    eprintf("         such that in the machine, t + h_ = t on the next step\n");
+	    eprintf("         solver will continue anyway.\n");
 	    if(nhnil == mxhnil) {
-	      Rcpp::Rcerr << "lsoda -- above warning has been issued " << nhnil
+	      errs() << "lsoda -- above warning has been issued " << nhnil
 			  << " times, " << "\n"
 			  << "       it will not be issued again for this problem" << "\n";
 	    }
@@ -802,6 +1162,8 @@ namespace LSODA {
 	  */
 	  init = 1;
 	  if(meth_ != mused) {
+	    if(mused != 0)
+	      nsw_++;
 	    tsw    = tn_;
 	    maxord = mxordn;
 	    if(meth_ == 2)
@@ -809,10 +1171,10 @@ namespace LSODA {
 	    jstart = -1;
 	    if(ixpr) {
 	      if(meth_ == 2)
-		Rcpp::Rcerr << "[lsoda] a switch to the stiff method has occurred "
+		errs() << "[lsoda] a switch to the stiff method has occurred "
 			    << "\n";
 	      if(meth_ == 1)
-		Rcpp::Rcerr << "[lsoda] a switch to the nonstiff method has occurred"
+		errs() << "[lsoda] a switch to the nonstiff method has occurred"
 			    << "\n";
 	    }
 	  } /* end if ( meth_ != mused )   */
@@ -891,15 +1253,15 @@ namespace LSODA {
 	  kflag = -2, convergence failed repeatedly or with fabs(h_) = hmin.
         */
 	if(kflag == -1 || kflag == -2) {
-	  REprintf("lsoda -- at t = %g and step size h_ = %g, the\n", tn_, h_);
+	  eprintf("lsoda -- at t = %g and step size h_ = %g, the\n", tn_, h_);
 	  if(kflag == -1) {
-	    REprintf("         error test failed repeatedly or\n");
-	    REprintf("         with std::abs(h_) = hmin\n");
+	    eprintf("         error test failed repeatedly or\n");
+	    eprintf("         with std::abs(h_) = hmin\n");
 	    *istate = -4;
 	  }
 	  if(kflag == -2) {
-	    REprintf("         corrector convergence failed repeatedly or\n");
-	    REprintf("         with std::abs(h_) = hmin\n");
+	    eprintf("         corrector convergence failed repeatedly or\n");
+	    eprintf("         with std::abs(h_) = hmin\n");
 	    *istate = -5;
 	  }
 	  big   = 0.;
@@ -923,8 +1285,8 @@ namespace LSODA {
       if(!(neq + 1 == y.size())) Rcpp::stop("neq + 1 != y.size()");
 
       size_t corflag = 0, orderflag = 0;
-      size_t i = 0, i1 = 0, j = 0, m = 0, ncf = 0;
-      double del = 0.0, delp = 0.0, dsm = 0.0, dup = 0.0, exup = 0.0, r = 0.0, rh = 0.0,
+      size_t i = 0, m = 0, ncf = 0, nje0 = 0, nbu0 = 0;
+      double del = 0.0, delp = 0.0, dsm = 0.0, dup = 0.0, exup = 0.0, rh = 0.0,
 	rhup = 0.0, told = 0.0;
       double pdh = 0.0, pnorm = 0.0;
 
@@ -988,7 +1350,10 @@ namespace LSODA {
 	hold  = h_;
 	nslp  = 0;
 	ipup  = miter;
+	jfd_  = 1;
 	iret = 3;
+	dsmold_  = 0.;
+	dsmlast_ = 0.;
 	/*
 	  Initialize switching parameters.  meth_ = 1 is assumed initially.
 	*/
@@ -996,14 +1361,18 @@ namespace LSODA {
 	irflag = 0;
 	pdest  = 0.;
 	pdlast = 0.;
-	ratio  = 5.;
+	ratio  = heur_.ratio;
 	cfode(2);
 	for(i = 1; i <= 5; i++)
 	  cm2[i] = tesco[i][2] * elco[i][i + 1];
 	cfode(1);
 	for(i = 1; i <= 12; i++)
 	  cm1[i] = tesco[i][2] * elco[i][i + 1];
+	if(meth_ == 2)
+	  cfode(2);
 	resetcoeff();
+	if(rpos_ < replay_.size())
+	  replaystart();
       } /* end if ( jstart == 0 )   */
       /*
 	The following block handles preliminaries needed when jstart = -1.
@@ -1018,6 +1387,7 @@ namespace LSODA {
       */
       if(jstart == -1) {
 	ipup = miter;
+	jfd_ = 1;
 	lmax = maxord + 1;
 	if(ialth == 1)
 	  ialth = 2;
@@ -1057,16 +1427,20 @@ namespace LSODA {
 	  if(nst >= nslp + msbp)
 	    ipup = miter;
 	  tn_ += h_;
-	  for(size_t j = nq; j >= 1; j--)
-	    for(size_t i1 = j; i1 <= nq; i1++)
-	      for(i = 1; i <= n; i++)
-		yh_[i1][i] += yh_[i1 + 1][i];
+	  pascal(false);
 
 	  pnorm = vmnorm(n, yh_[1], ewt);
+	  nje0  = nje;
+	  nbu0  = nbu;
+	  ncor_ = 0;
 	  correction(
 		     neq, y, f, &corflag, pnorm, &del, &delp, &told, &ncf, &rh, &m, _data);
 	  if(corflag == 0)
 	    break;
+	  if(!trace_.empty())
+	    tracestep(told, nje0, nbu0, 2);
+	  // a replayed step cannot be retried: the solve goes on adaptively
+	  rpos_ = replay_.size();
 	  if(corflag == 1) {
 	    rh = std::max(rh, hmin / std::abs(h_));
 	    scaleh(&rh, &pdh);
@@ -1086,10 +1460,14 @@ namespace LSODA {
 	  The local error test is done now.
         */
 	jcur = 0;
-	if(m == 0)
+	if(rpos_ < replay_.size())
+	  dsm = 0.; // a replayed step is accepted without the test
+	else if(m == 0)
 	  dsm = del / tesco[nq][2];
-	if(m > 0)
+	else
 	  dsm = vmnorm(n, acor, ewt) / tesco[nq][2];
+	if(!trace_.empty())
+	  tracestep(told, nje0, nbu0, (dsm <= 1.) ? 0 : 1);
 
 	if(dsm <= 1.) {
 	  /*
@@ -1107,18 +1485,32 @@ namespace LSODA {
 	  */
 	  kflag = 0;
 	  nst++;
+	  dsmold_  = dsmlast_;
+	  dsmlast_ = dsm;
 	  hu    = h_;
 	  nqu   = nq;
 	  mused = meth_;
-	  for(size_t j = 1; j <= l; j++) {
-	    r = el[j];
-	    for(i = 1; i <= n; i++)
-	      yh_[j][i] += r * acor[i];
+	  LSODA_VECTOR_FOR
+	  for(i = 1; i <= n; i++)
+	    for(size_t j = 1; j <= l; j++)
+	      yh_[j][i] += el[j] * acor[i];
+	  if(record_)
+	    steps_.push_back(StepRecord{tn_, h_, (int)nq, (int)meth_});
+	  /*
+	    When replaying, the next step size, order and method are those
+	    recorded, rather than chosen.
+	  */
+	  if(rpos_ < replay_.size()) {
+	    nrp_++;
+	    replaynext();
+	    endstoda();
+	    break;
 	  }
 	  icount--;
-	  if(icount < 0) {
+	  if(icount < 0 && mass_.empty()) {
 	    methodswitch(dsm, pnorm, &pdh, &rh);
 	    if(meth_ != mused) {
+	      dsmlast_ = 0.;
 	      rh = std::max(rh, hmin / std::abs(h_));
 	      scaleh(&rh, &pdh);
 	      rmax = 10.;
@@ -1133,6 +1525,7 @@ namespace LSODA {
 	  if(ialth == 0) {
 	    rhup = 0.;
 	    if(l != lmax) {
+	      LSODA_VECTOR_FOR
 	      for(i = 1; i <= n; i++)
 		savf[i] = acor[i] - yh_[lmax][i];
 	      dup  = vmnorm(n, savf, ewt) / tesco[nq][3];
@@ -1163,6 +1556,7 @@ namespace LSODA {
 	      both nq and h_ are changed.
 	    */
 	    if(orderflag == 2) {
+	      dsmlast_ = 0.;
 	      resetcoeff();
 	      rh = std::max(rh, hmin / std::abs(h_));
 	      scaleh(&rh, &pdh);
@@ -1192,12 +1586,9 @@ namespace LSODA {
 	*/
 	else {
 	  kflag--;
+	  dsmlast_ = 0.;
 	  tn_ = told;
-	  for(j = nq; j >= 1; j--) {
-	    for(i1 = j; i1 <= nq; i1++)
-	      for(i = 1; i <= n; i++)
-		yh_[i1][i] -= yh_[i1 + 1][i];
-	  }
+	  pascal(true);
 	  rmax = 2.;
 	  if(std::abs(h_) <= hmin * 1.00001) {
 	    kflag  = -1;
@@ -1247,7 +1638,8 @@ namespace LSODA {
 	      (*f)(tn_, &y[1], &savf[1], _data);
 	      nfe++;
 	      for(i = 1; i <= n; i++)
-		yh_[2][i] = h_ * savf[i];
+		yh_[2][i] = savf[i];
+	      massscale(yh_[2], h_);
 	      ipup  = miter;
 	      ialth = 5;
 	      if(nq == 1)
@@ -1263,22 +1655,81 @@ namespace LSODA {
 
     } /* end stoda   */
 
+    /*
+      Record the attempt that ended in stoda with the given outcome in the
+      trace, overwriting the oldest entry once the buffer is full.
+    */
+    void tracestep(double told, size_t nje0, size_t nbu0, int outcome)
+    {
+      TraceEntry &e = trace_[ntrace_ % trace_.size()];
+      e.t          = told + h_;
+      e.h          = h_;
+      e.order      = (int)nq;
+      e.method     = (int)meth_;
+      e.iterations = (int)ncor_;
+      e.jacobian   = (nbu > nbu0) ? 2 : (nje > nje0) ? 1 : 0;
+      e.outcome    = outcome;
+      ntrace_++;
+    }
+
+    /*
+      Initial step size as in Hairer, Norsett and Wanner ( Solving ODEs I,
+      section II.4 ), for the first order method of the first step:
+      with d0 = norm(y) and d1 = norm(f(t,y)) in the weighted norm, an
+      explicit Euler step of size h = 0.01 * d0 / d1 gives an estimate
+      d2 = norm(f(t+h, y+h*f) - f(t,y)) / h of the second derivative, and
+
+      h0 = min( 100 * h, ( 0.01 / max(d1, d2) )^(1/2) ).
+
+      This costs one more call to f than the default formula, but takes
+      the curvature of the solution into account.  acor and savf are
+      used as work space, and yh_[2] holds f(t,y).  Returns fabs(h0).
+    */
+    double initialstep(LSODA_ODE_SYSTEM_TYPE f, const std::vector<double> &y, double t,
+		       double tout, double d1, void *_data)
+    {
+      double d0, d2, dm, h, h1;
+
+      d0 = vmnorm(n, y, ewt);
+      h  = (d0 < 1.e-5 || d1 < 1.e-5) ? 1.e-6 : 0.01 * d0 / d1;
+      h  = std::min(h, std::abs(tout - t));
+      h  = sign(h, tout - t);
+      for(size_t i = 1; i <= n; i++)
+	acor[i] = y[i] + h * yh_[2][i];
+      (*f)(t + h, &acor[1], &savf[1], _data);
+      nfe++;
+      massscale(savf, 1.);
+      for(size_t i = 1; i <= n; i++)
+	savf[i] -= yh_[2][i];
+      d2 = vmnorm(n, savf, ewt) / std::abs(h);
+      dm = std::max(d1, d2);
+      if(dm <= 1.e-15)
+	h1 = std::max(1.e-6, std::abs(h) * 1.e-3);
+      else
+	h1 = sqrt(0.01 / dm);
+      return std::min(100. * std::abs(h), h1);
+    }
+
     void ewset(const std::vector<double> &ycur)
     {
       switch(itol_) {
       case 1:
+	LSODA_VECTOR_FOR
 	for(size_t i = 1; i <= n; i++)
 	  ewt[i] = rtol_[1] * std::abs(ycur[i]) + atol_[1];
 	break;
       case 2:
+	LSODA_VECTOR_FOR
 	for(size_t i = 1; i <= n; i++)
 	  ewt[i] = rtol_[1] * std::abs(ycur[i]) + atol_[i];
 	break;
       case 3:
+	LSODA_VECTOR_FOR
 	for(size_t i = 1; i <= n; i++)
 	  ewt[i] = rtol_[i] * std::abs(ycur[i]) + atol_[1];
 	break;
       case 4:
+	LSODA_VECTOR_FOR
 	for(size_t i = 1; i <= n; i++)
 	  ewt[i] = rtol_[i] * std::abs(ycur[i]) + atol_[i];
 	break;
@@ -1316,11 +1767,12 @@ namespace LSODA {
     void intdy(double t, int k, std::vector<double> &dky, int *iflag)
     {
       int ic, jp1 = 0;
+      size_t ni;
       double c, r, s, tp, tfuzz, tn1;
 
       *iflag = 0;
       if(k < 0 || k > (int)nq) {
-	REprintf("[intdy] k = %d illegal\n", k);
+	eprintf("[intdy] k = %d illegal\n", k);
 	*iflag = -1;
 	return;
       }
@@ -1329,17 +1781,24 @@ namespace LSODA {
       // tp = tn_ - hu - 100. * ETA * (tn_ + hu);
       tn1 = tn_ + tfuzz;
       if((t - tp) * (t - tn1) > 0.) {
-	REprintf("intdy -- t = %g illegal. t not in interval tcur - hu to tcur\n", t);
+	eprintf("intdy -- t = %g illegal. t not in interval tcur - hu to tcur\n", t);
 	*iflag = -2;
 	return;
       }
+      /*
+	Only the components in iout_ are interpolated, if it is not empty.
+      */
+      ni = iout_.empty() ? n : iout_.size();
       s  = (t - tn_) / h_;
       ic = 1;
       for(size_t jj = l - k; jj <= nq; jj++)
 	ic *= jj;
       c = (double)ic;
-      for(size_t i = 1; i <= n; i++)
+      LSODA_VECTOR_FOR
+      for(size_t ii = 1; ii <= ni; ii++) {
+	size_t i = iout_.empty() ? ii : iout_[ii - 1];
 	dky[i] = c * yh_[l][i];
+      }
 
       for(int j = nq - 1; j >= k; j--) {
 	jp1 = j + 1;
@@ -1348,15 +1807,21 @@ namespace LSODA {
 	  ic *= jj;
 	c = (double)ic;
 
-	for(size_t i = 1; i <= n; i++)
+	LSODA_VECTOR_FOR
+	for(size_t ii = 1; ii <= ni; ii++) {
+	  size_t i = iout_.empty() ? ii : iout_[ii - 1];
 	  dky[i] = c * yh_[jp1][i] + s * dky[i];
+	}
       }
       if(k == 0)
 	return;
       r = pow(h_, (double)(-k));
 
-      for(size_t i = 1; i <= n; i++)
+      LSODA_VECTOR_FOR
+      for(size_t ii = 1; ii <= ni; ii++) {
+	size_t i = iout_.empty() ? ii : iout_[ii - 1];
 	dky[i] *= r;
+      }
 
     } /* end intdy   */
 
@@ -1489,7 +1954,6 @@ namespace LSODA {
 
     void scaleh(double *rh, double *pdh)
     {
-      double r;
       /*
 	If h_ is being changed, the h_ ratio rh is checked against rmax, hmin,
 	and hmxi, and the yh_ array is rescaled.  ialth is set to l = nq + 1
@@ -1511,17 +1975,86 @@ namespace LSODA {
 	  irflag = 1;
 	}
       }
-      r = 1.;
-      for(size_t j = 2; j <= l; j++) {
-	r *= *rh;
-	for(size_t i = 1; i <= n; i++)
-	  yh_[j][i] *= r;
+      rescale(*rh);
+
+    } /* end scaleh   */
+
+    /*
+      Change h_ by the factor r, rescaling the yh_ array.
+    */
+    void rescale(double r)
+    {
+      LSODA_VECTOR_FOR
+      for(size_t i = 1; i <= n; i++) {
+	double rj = 1.;
+	for(size_t j = 2; j <= l; j++) {
+	  rj *= r;
+	  yh_[j][i] *= rj;
+	}
       }
-      h_ *= *rh;
-      rc *= *rh;
+      h_ *= r;
+      rc *= r;
       ialth = l;
+    }
 
-    } /* end scaleh   */
+    /*
+      Start a replay ( set_replay() ) on the first step: the recorded
+      first step must start at tn_, in the direction of h_, and be of order
+      1 with the method started with; otherwise the solve is adaptive.
+    */
+    void replaystart()
+    {
+      const StepRecord &s = replay_[0];
+      double t0 = s.t - s.h;
+      if(s.order != 1 || s.method != (int)meth_ || s.h * h_ <= 0. ||
+	 std::abs(t0 - tn_) > 100. * ETA * std::max(std::abs(tn_), std::abs(s.h))) {
+	rpos_ = replay_.size();
+	return;
+      }
+      rescale(s.h / h_);
+      h_ = s.h;
+    }
+
+    /*
+      After replayed step rpos_, set up the next recorded step, as
+      methodswitch and orderswitch would: a switch of method ( to an order
+      no higher ), an order one higher from acor, or a lower order, and the
+      step size.  After the last recorded step, or one that the order
+      cannot follow, the solve goes on adaptively.
+    */
+    void replaynext()
+    {
+      if(++rpos_ == replay_.size())
+	return;
+      const StepRecord &s = replay_[rpos_];
+      if(s.method != (int)meth_) {
+	meth_  = s.method;
+	miter  = (meth_ == 2) ? jtyp : 0;
+	icount = 20;
+	pdlast = 0.;
+	nq     = std::min(nq, (size_t)s.order);
+	l      = nq + 1;
+      }
+      else if(s.order == (int)nq + 1 && l < lmax) {
+	double r = el[l] / (double)l;
+	nq = l;
+	l  = nq + 1;
+	for(size_t i = 1; i <= n; i++)
+	  yh_[l][i] = acor[i] * r;
+	resetcoeff();
+      }
+      else if(s.order < (int)nq) {
+	nq = s.order;
+	l  = nq + 1;
+	resetcoeff();
+      }
+      else if(s.order != (int)nq) {
+	rpos_ = replay_.size();
+	return;
+      }
+      rescale(s.h / h_);
+      h_ = s.h;
+    }
 
     void prja(
 	      const size_t neq, std::vector<double> &y, LSODA_ODE_SYSTEM_TYPE f, void *_data)
@@ -1533,33 +2066,70 @@ namespace LSODA {
       /*
 	prja is called by stoda to compute and process the matrix
 	P = I - h_ * el[1] * J, where J is an approximation to the Jacobian.
-	Here J is computed by finite differencing.
+	Here J is computed by the user-supplied routine jacfn_ if miter = 1,
+	or by finite differencing if miter = 2, 5 or 7.
 	J, scaled by -h_ * el[1], is stored in wm_.  Then the norm of J ( the
 	matrix norm consistent with the weighted max-norm on vectors given
 	by vmnorm ) is computed, and J is overwritten by P.  P is then
 	subjected to LU decomposition in preparation for later solution
 	of linear systems with p as coefficient matrix.  This is done
-	by dgefa if miter = 2, and by dgbfa if miter = 5.
+	by dgefa if miter = 1 or 2, and by dgbfa if miter = 5.
       */
       nje++;
       ierpj = 0;
       jcur  = 1;
       hl0   = h_ * el0;
+      if(miter != 1 && miter != 2 && miter != 5 && miter != 7) {
+	eprintf("[prja] miter != 1, 2, 5 or 7\n");
+	return;
+      }
+      fac = vmnorm(n, savf, ewt);
+      r0  = 1000. * std::abs(h_) * ETA * ((double)n) * fac;
+      if(r0 == 0.)
+	r0 = 1.;
       /*
-	If miter = 2, make n calls to f to approximate J.
+	If miter = 1, call jacfn_ and load -h_ * el[1] * J into wm_.
       */
-      if(miter != 2) {
-	REprintf("[prja] miter != 2\n");
-	return;
+      if(miter == 1) {
+	std::fill(jacpd_.begin(), jacpd_.end(), 0.);
+	(*jacfn_)(tn_, &y[1], &jacpd_[0], jacdata_);
+	for(i = 1; i <= n; i++)
+	  for(j = 1; j <= n; j++)
+	    wm_[i][j] = -hl0 * jacpd_[(i - 1) + n * (j - 1)];
+      }
+      /*
+	If miter = 2 and the columns of J have been grouped (jt = 6),
+	make one call to f per group of structurally orthogonal columns.
+      */
+      if(miter == 2 && !jgptr_.empty()) {
+	for(i = 1; i <= n; i++)
+	  std::fill(wm_[i].begin(), wm_[i].end(), 0.);
+	size_t ngrp = jgptr_.size() - 1;
+	for(size_t g = 0; g < ngrp; g++) {
+	  for(size_t k = jgptr_[g]; k < jgptr_[g + 1]; k++) {
+	    j = jgcol_[k];
+	    y[j] += fdinc(j, y[j], r0);
+	  }
+	  (*f)(tn_, &y[1], &acor[1], _data);
+	  for(size_t k = jgptr_[g]; k < jgptr_[g + 1]; k++) {
+	    j    = jgcol_[k];
+	    y[j] = yh_[1][j];
+	    fac  = -hl0 / fdinc(j, y[j], r0);
+	    for(size_t p = jcolptr_[j]; p < jcolptr_[j + 1]; p++) {
+	      i         = jrowind_[p];
+	      wm_[i][j] = (acor[i] - savf[i]) * fac;
+	    }
+	  }
+	}
+	nfe += ngrp;
       }
-      if(miter == 2) {
-	fac = vmnorm(n, savf, ewt);
-	r0  = 1000. * std::abs(h_) * ETA * ((double)n) * fac;
-	if(r0 == 0.)
-	  r0 = 1.;
+      /*
+	If miter = 2, make n calls to f to approximate J.
+      */
+      else if(miter == 2) {
 	for(j = 1; j <= n; j++) {
 	  yj = y[j];
-	  r  = std::max(sqrteta * std::abs(yj), r0 / ewt[j]);
+	  r  = fdinc(j, yj, r0);
 	  y[j] += r;
 	  fac = -hl0 / r;
 	  (*f)(tn_, &y[1], &acor[1], _data);
@@ -1568,15 +2138,27 @@ namespace LSODA {
 	  y[j] = yj;
 	}
 	nfe += n;
+      }
+      if(miter == 1 || miter == 2) {
+	/*
+	  Keep J itself for Broyden updates, if these are enabled.
+	*/
+	if(!jac_.empty()) {
+	  for(i = 1; i <= n; i++)
+	    for(j = 1; j <= n; j++)
+	      jac_[i][j] = wm_[i][j] / -hl0;
+	  jfd_  = 0;
+	  nbrf_ = 0;
+	}
 	/*
 	  Compute norm of Jacobian.
 	*/
 	pdnorm = fnorm(n, wm_, ewt) / std::abs(hl0);
 	/*
-	  Add identity matrix.
+	  Add identity matrix, or the mass matrix M for a DAE.
 	*/
 	for(i = 1; i <= n; i++)
-	  wm_[i][i] += 1.;
+	  wm_[i][i] += mass_.empty() ? 1. : mass_[i];
 	/*
 	  Do LU decomposition on P.
 	*/
@@ -1585,38 +2167,386 @@ namespace LSODA {
 	  ierpj = 1;
 	return;
       }
+      /*
+	If miter = 5, make ml + mu + 1 calls to f to approximate J,
+	perturbing every ( ml + mu + 1 )-th column together.
+      */
+      if(miter == 5) {
+	size_t mband = ml + mu + 1, mba = std::min(mband, n);
+	for(j = 1; j <= mba; j++) {
+	  for(i = j; i <= n; i += mband)
+	    y[i] += fdinc(i, y[i], r0);
+	  (*f)(tn_, &y[1], &acor[1], _data);
+	  for(size_t jj = j; jj <= n; jj += mband) {
+	    y[jj]     = yh_[1][jj];
+	    fac       = -hl0 / fdinc(jj, y[jj], r0);
+	    size_t i1 = (jj > mu) ? jj - mu : 1;
+	    size_t i2 = std::min(jj + ml, n);
+	    for(i = i1; i <= i2; i++)
+	      wb_[jj][i - jj + mband] = (acor[i] - savf[i]) * fac;
+	  }
+	}
+	nfe += mba;
+	/*
+	  Compute norm of Jacobian.
+	*/
+	pdnorm = bnorm(n, wb_, ml, mu, ewt) / std::abs(hl0);
+	/*
+	  Add identity matrix, or the mass matrix M for a DAE.
+	*/
+	for(i = 1; i <= n; i++)
+	  wb_[i][mband] += mass_.empty() ? 1. : mass_[i];
+	/*
+	  Do LU decomposition on P.
+	*/
+	dgbfa(wb_, n, ml, mu, ipvt, &ier);
+	if(ier != 0)
+	  ierpj = 1;
+      }
+      /*
+	If miter = 7, J is block diagonal with n / mb blocks of size mb.
+	Make mb calls to f, perturbing the same column of every block
+	together, and factor each block separately.
+      */
+      if(miter == 7) {
+	size_t nb = n / mb;
+	for(j = 1; j <= mb; j++) {
+	  for(size_t jj = j; jj <= n; jj += mb)
+	    y[jj] += fdinc(jj, y[jj], r0);
+	  (*f)(tn_, &y[1], &acor[1], _data);
+	  for(size_t b = 0; b < nb; b++) {
+	    size_t jj = b * mb + j;
+	    y[jj]     = yh_[1][jj];
+	    fac       = -hl0 / fdinc(jj, y[jj], r0);
+	    for(i = 1; i <= mb; i++)
+	      wd_[b][i][j] = (acor[b * mb + i] - savf[b * mb + i]) * fac;
+	  }
+	}
+	nfe += mb;
+	/*
+	  Compute norm of Jacobian, add the identity ( or M ) and do the
+	  LU decomposition, block by block.
+	*/
+	pdnorm = 0.;
+	for(size_t b = 0; b < nb; b++) {
+	  for(i = 1; i <= mb; i++) {
+	    double sum = 0., aij = 0.;
+	    for(j = 1; j <= mb; j++) {
+	      aij = wd_[b][i][j] * ewt[b * mb + i] / ewt[b * mb + j];
+	      sum += (norm_ == 2) ? aij * aij : std::abs(aij);
+	    }
+	    pdnorm = (norm_ == 2) ? pdnorm + sum : std::max(pdnorm, sum);
+	  }
+	  for(i = 1; i <= mb; i++)
+	    wd_[b][i][i] += mass_.empty() ? 1. : mass_[b * mb + i];
+	  dgefa(wd_[b], mb, ipvtd_[b], &ier);
+	  if(ier != 0)
+	    ierpj = 1;
+	}
+	if(norm_ == 2)
+	  pdnorm = std::sqrt(pdnorm);
+	pdnorm /= std::abs(hl0);
+      }
     } /* end prja   */
 
     /*
-      This function routine computes the weighted max-norm
-      of the vector of length n contained in the array v, with weights
-      contained in the array w of length n.
+      Increment used for column j in the difference quotients of prja.
+      For a DAE, the increment is also bounded below as in dassl, so that
+      the algebraic columns are not lost to roundoff.
+    */
+    double fdinc(const size_t j, const double yj, const double r0)
+    {
+      double r = std::max(sqrteta * std::abs(yj), r0 / ewt[j]);
+      if(!mass_.empty())
+	r = std::max(r, sqrteta * std::max(std::abs(yh_[2][j]), 1. / ewt[j]));
+      return r;
+    }
 
-      vmnorm = std::max( i = 1, ..., n ) fabs( v[i] ) * w[i].
+    /*
+      prjb is called instead of prja when Broyden updates are enabled
+      (broyden_ > 0, miter = 2) and the stored J is still trusted.  It
+      forms P = I - h_ * el[1] * J (or M - h_ * el[1] * J for a DAE) from
+      the J kept by prja and updated since by broydenupdate, and does the
+      LU decomposition, without any call to f.  jcur is left at 0, so a
+      convergence failure with this P leads to a finite difference J.
     */
-    double vmnorm(const size_t n, const std::vector<double> &v, const std::vector<double> &w)
+    void prjb()
     {
-      double vm = 0.;
+      size_t ier = 0;
+      double hl0 = h_ * el0;
+
+      nbu++;
+      nbrf_++;
+      ierpj = 0;
+      jcur  = 0;
       for(size_t i = 1; i <= n; i++)
-	vm = std::max(vm, std::abs(v[i]) * w[i]);
-      return vm;
+	for(size_t j = 1; j <= n; j++)
+	  wm_[i][j] = -hl0 * jac_[i][j];
+      pdnorm = fnorm(n, wm_, ewt) / std::abs(hl0);
+      for(size_t i = 1; i <= n; i++)
+	wm_[i][i] += mass_.empty() ? 1. : mass_[i];
+      dgefa(wm_, n, ipvt, &ier);
+      if(ier != 0)
+	ierpj = 1;
     }
 
-    double fnorm(int n, const std::vector<std::vector<double>> &a, const std::vector<double> &w)
-
     /*
-      This subroutine computes the norm of a full n by n matrix,
-      stored in the array a, that is consistent with the weighted max-norm
-      on vectors, with weights stored in the array w.
-
-      fnorm = std::max(i=1,...,n) ( w[i] * sum(j=1,...,n) fabs( a[i][j] ) / w[j] )
+      broydenupdate is called by correction after each f evaluation at a
+      new corrector iterate y, with the previous iterate and its f value
+      in bry_ and brf_.  With s = y - bry_ and df = savf - brf_, the stored
+      J gets the rank-one update
+        J += ( df - J s ) ( W s )^T / ( s^T W s ),   W = diag( ewt^2 ),
+      the Broyden update in the weighted norm of the error test, so that
+      J s = df afterwards.  The new iterate then replaces the old one.
     */
-
+    void broydenupdate(const std::vector<double> &y)
     {
-      double an = 0, sum = 0;
+      double ss = 0.0, r = 0.0;
 
-      for(size_t i = 1; i <= (size_t)n; i++) {
-	sum = 0.;
+      for(size_t j = 1; j <= n; j++) {
+	bry_[j] = y[j] - bry_[j];
+	ss += bry_[j] * bry_[j] * ewt[j] * ewt[j];
+      }
+      if(ss > 0.) {
+	for(size_t i = 1; i <= n; i++) {
+	  r = savf[i] - brf_[i];
+	  for(size_t j = 1; j <= n; j++)
+	    r -= jac_[i][j] * bry_[j];
+	  r /= ss;
+	  for(size_t j = 1; j <= n; j++)
+	    jac_[i][j] += r * bry_[j] * ewt[j] * ewt[j];
+	}
+      }
+      std::copy(y.begin(), y.end(), bry_.begin());
+      std::copy(savf.begin(), savf.end(), brf_.begin());
+    }
+
+    /*
+      Allocate the iteration matrix for the current Jacobian type:
+      a full matrix in wm_ for jtyp = 1 or 2 (and a column-major buffer
+      jacpd_ for the user's Jacobian if jtyp = 1), band storage of
+      2 * ml + mu + 1 rows by n columns in wb_ for jtyp = 4 or 5, or
+      n / mb full blocks of size mb in wd_ for jtyp = 7.
+      With Broyden updates and jtyp = 2, J itself is also kept in jac_.
+    */
+    void jacalloc()
+    {
+      jac_.clear();
+      if(jtyp == 2 && broyden_ > 0) {
+	jac_.resize(nyh + 1);
+	for(size_t i = 0; i <= nyh; i++)
+	  jac_[i].resize(nyh + 1, 0.0);
+	bry_.resize(nyh + 1, 0.0);
+	brf_.resize(nyh + 1, 0.0);
+      }
+      if(jtyp == 1 || jtyp == 2) {
+	wm_.resize(nyh + 1);
+	for(size_t i = 0; i <= nyh; i++)
+	  wm_[i].resize(nyh + 1, 0.0);
+      }
+      if(jtyp == 1)
+	jacpd_.resize(nyh * nyh, 0.0);
+      if(jtyp == 4 || jtyp == 5) {
+	wb_.resize(nyh + 1);
+	for(size_t j = 0; j <= nyh; j++)
+	  wb_[j].assign(2 * ml + mu + 2, 0.0);
+      }
+      if(jtyp == 7) {
+	wd_.resize(nyh / mb);
+	ipvtd_.resize(nyh / mb);
+	for(size_t b = 0; b < nyh / mb; b++) {
+	  wd_[b].resize(mb + 1);
+	  for(size_t i = 0; i <= mb; i++)
+	    wd_[b][i].resize(mb + 1, 0.0);
+	  ipvtd_[b].resize(mb + 1, 0);
+	}
+	wdtmp_.resize(mb + 1, 0.0);
+      }
+    }
+
+    /*
+      jacdetect is called for jt = 6 before the first step.  It finds the
+      sparsity pattern of J by differencing f about two randomly perturbed
+      base points near the initial y, with small and then larger
+      perturbations, so that entries which happen to vanish at the initial
+      values, or are lost to roundoff, are still found.  This costs
+      2 * ( n + 1 ) calls to f.  The pattern is kept in compressed
+      columns (jcolptr_, jrowind_), and from it jtyp is set to
+        5  if the band storage is no more than half of a full matrix,
+        2  with column groups (jgptr_, jgcol_) for prja if the columns
+           can be packed into at most n / 2 structurally orthogonal
+           groups, or
+        2  with a full finite difference Jacobian otherwise.
+    */
+    void jacdetect(LSODA_ODE_SYSTEM_TYPE f, std::vector<double> &y, void *_data)
+    {
+      const double rels[2] = {1.e-4, 0.1};
+      std::vector<std::vector<size_t>> cols(n + 1);
+      std::vector<size_t> rows;
+      uint32_t seed = 12345u;
+      auto unif = [&seed]() -> double {
+	seed = 1664525u * seed + 1013904223u;
+	return (seed >> 8) * (1.0 / 16777216.0);
+      };
+      for(size_t j = 1; j <= n; j++)
+	cols[j].push_back(j);
+      for(double rel : rels) {
+	for(size_t i = 1; i <= n; i++) {
+	  double sc = std::max(std::max(std::abs(yh_[1][i]), 1. / ewt[i]), sqrteta);
+	  y[i]      = yh_[1][i] + rel * sc * (0.5 + unif()) * (unif() < 0.5 ? -1. : 1.);
+	}
+	(*f)(tn_, &y[1], &savf[1], _data);
+	for(size_t j = 1; j <= n; j++) {
+	  double yj = y[j];
+	  double sc = std::max(std::max(std::abs(yj), 1. / ewt[j]), sqrteta);
+	  y[j] += rel * sc * (0.5 + unif());
+	  (*f)(tn_, &y[1], &acor[1], _data);
+	  y[j] = yj;
+	  /*
+	    Merge the rows that changed (or became NaN) into column j.
+	  */
+	  rows.clear();
+	  std::vector<size_t>::const_iterator it = cols[j].begin();
+	  for(size_t i = 1; i <= n; i++) {
+	    bool seen = (it != cols[j].end() && *it == i);
+	    if(seen)
+	      it++;
+	    if(seen || !(acor[i] == savf[i]))
+	      rows.push_back(i);
+	  }
+	  cols[j].swap(rows);
+	}
+	nfe += n + 1;
+      }
+      for(size_t i = 1; i <= n; i++)
+	y[i] = yh_[1][i];
+      /*
+	Compressed columns, and the bandwidths.
+      */
+      jcolptr_.assign(n + 2, 0);
+      jrowind_.clear();
+      ml = mu = 0;
+      for(size_t j = 1; j <= n; j++) {
+	jcolptr_[j] = jrowind_.size();
+	for(size_t i : cols[j]) {
+	  jrowind_.push_back(i);
+	  if(i > j)
+	    ml = std::max(ml, i - j);
+	  else
+	    mu = std::max(mu, j - i);
+	}
+	std::vector<size_t>().swap(cols[j]);
+      }
+      jcolptr_[n + 1] = jrowind_.size();
+      /*
+	Greedy grouping of columns that share no rows (Curtis, Powell and
+	Reid), using the transposed pattern in (rowptr, colind).
+	mark[g] == j records that group g holds a column sharing a row
+	with column j.
+      */
+      std::vector<size_t> rowptr(n + 2, 0), colind(jrowind_.size()), group(n + 1, 0),
+	mark(n + 2, 0);
+      for(size_t i : jrowind_)
+	rowptr[i + 1]++;
+      for(size_t i = 1; i <= n; i++)
+	rowptr[i + 1] += rowptr[i];
+      for(size_t j = 1; j <= n; j++)
+	for(size_t p = jcolptr_[j]; p < jcolptr_[j + 1]; p++)
+	  colind[rowptr[jrowind_[p]]++] = j;
+      for(size_t i = n; i >= 1; i--)
+	rowptr[i + 1] = rowptr[i];
+      rowptr[1] = 0;
+      size_t ngrp = 0;
+      for(size_t j = 1; j <= n; j++) {
+	for(size_t p = jcolptr_[j]; p < jcolptr_[j + 1]; p++) {
+	  size_t i = jrowind_[p];
+	  for(size_t q = rowptr[i]; q < rowptr[i + 1] && colind[q] < j; q++)
+	    mark[group[colind[q]]] = j;
+	}
+	size_t g = 1;
+	while(g <= ngrp && mark[g] == j)
+	  g++;
+	group[j] = g;
+	ngrp     = std::max(ngrp, g);
+      }
+      jgptr_.clear();
+      jgcol_.clear();
+      if(2 * ml + mu + 1 <= n / 2) {
+	jtyp = 5;
+	return;
+      }
+      jtyp = 2;
+      if(ngrp <= n / 2) {
+	/*
+	  Group g holds columns jgcol_[jgptr_[g - 1]] to jgcol_[jgptr_[g] - 1],
+	  for g = 1, ..., ngrp.
+	*/
+	jgptr_.assign(ngrp + 1, 0);
+	jgcol_.resize(n);
+	for(size_t j = 1; j <= n; j++)
+	  jgptr_[group[j]]++;
+	for(size_t g = 1; g <= ngrp; g++)
+	  jgptr_[g] += jgptr_[g - 1];
+	for(size_t j = n; j >= 1; j--)
+	  jgcol_[--jgptr_[group[j]]] = j;
+	for(size_t g = 0; g < ngrp; g++)
+	  jgptr_[g] = jgptr_[g + 1];
+	jgptr_[ngrp] = n;
+      }
+    }
+
+    /*
+      This function routine computes the weighted max-norm
+      of the vector of length n contained in the array v, with weights
+      contained in the array w of length n.
+
+      vmnorm = std::max( i = 1, ..., n ) fabs( v[i] ) * w[i].
+
+      With set_norm(2), it is the weighted root-mean-square norm instead,
+
+      vmnorm = sqrt( sum( i = 1, ..., n ) ( v[i] * w[i] )^2 / n ).
+    */
+    double vmnorm(const size_t n, const std::vector<double> &v, const std::vector<double> &w)
+    {
+      double vm = 0.;
+      if(norm_ == 2) {
+	LSODA_VECTOR_REDUCE(+, vm)
+	for(size_t i = 1; i <= n; i++)
+	  vm += (v[i] * w[i]) * (v[i] * w[i]);
+	return std::sqrt(vm / (double)n);
+      }
+      LSODA_VECTOR_REDUCE(max, vm)
+      for(size_t i = 1; i <= n; i++)
+	vm = std::max(vm, std::abs(v[i]) * w[i]);
+      return vm;
+    }
+
+    double fnorm(int n, const std::vector<std::vector<double>> &a, const std::vector<double> &w)
+
+    /*
+      This subroutine computes the norm of a full n by n matrix,
+      stored in the array a, that is consistent with the weighted max-norm
+      on vectors, with weights stored in the array w.
+
+      fnorm = std::max(i=1,...,n) ( w[i] * sum(j=1,...,n) fabs( a[i][j] ) / w[j] )
+
+      For the root-mean-square norm, it is the Frobenius norm of the
+      weighted matrix, which bounds the norm induced by it,
+
+      fnorm = sqrt( sum(i,j=1,...,n) ( w[i] * a[i][j] / w[j] )^2 )
+    */
+
+    {
+      double an = 0, sum = 0;
+
+      if(norm_ == 2) {
+	for(size_t i = 1; i <= (size_t)n; i++)
+	  for(size_t j = 1; j <= (size_t)n; j++)
+	    an += (a[i][j] * w[i] / w[j]) * (a[i][j] * w[i] / w[j]);
+	return std::sqrt(an);
+      }
+      for(size_t i = 1; i <= (size_t)n; i++) {
+	sum = 0.;
 	for(size_t j = 1; j <= (size_t)n; j++)
 	  sum += std::abs(a[i][j]) / w[j];
 	an = std::max(an, sum * w[i]);
@@ -1624,6 +2554,40 @@ namespace LSODA {
       return an;
     }
 
+    /*
+      This subroutine computes the norm of a banded n by n matrix,
+      stored in the array a as for dgbfa, that is consistent with the
+      weighted max-norm on vectors, with weights stored in the array w.
+      ml and mu are the lower and upper half-bandwidths of the matrix.
+
+      bnorm = std::max(i=1,...,n) ( w[i] * sum(j=jlo,...,jhi) fabs( a[i][j] ) / w[j] )
+
+      or the Frobenius norm of the weighted band for the root-mean-square
+      norm, as for fnorm.
+    */
+    double bnorm(const size_t n, const std::vector<std::vector<double>> &a, const size_t ml,
+		 const size_t mu, const std::vector<double> &w)
+    {
+      double an = 0, sum = 0, aij = 0;
+
+      for(size_t i = 1; i <= n; i++) {
+	sum        = 0.;
+	size_t jlo = (i > ml) ? i - ml : 1;
+	size_t jhi = std::min(i + mu, n);
+	if(norm_ == 2) {
+	  for(size_t j = jlo; j <= jhi; j++) {
+	    aij = a[j][i - j + ml + mu + 1] * w[i] / w[j];
+	    an += aij * aij;
+	  }
+	  continue;
+	}
+	for(size_t j = jlo; j <= jhi; j++)
+	  sum += std::abs(a[j][i - j + ml + mu + 1]) / w[j];
+	an = std::max(an, sum * w[i]);
+      }
+      return (norm_ == 2) ? std::sqrt(an) : an;
+    }
+
     /*
      *corflag = 0 : corrector converged,
      1 : step size to be reduced, redo prediction,
@@ -1646,21 +2610,31 @@ namespace LSODA {
       *corflag = 0;
       *del     = 0.;
 
+      LSODA_VECTOR_FOR
       for(size_t i = 1; i <= n; i++)
 	y[i] = yh_[1][i];
 
       (*f)(tn_, &y[1], &savf[1], _data);
 
       nfe++;
+      if(miter == 2 && !jac_.empty()) {
+	std::copy(y.begin(), y.end(), bry_.begin());
+	std::copy(savf.begin(), savf.end(), brf_.begin());
+      }
       /*
 	If indicated, the matrix P = I - h_ * el[1] * J is reevaluated and
 	preprocessed before starting the corrector iteration.  ipup is set
-	to 0 as an indicator that this has been done.
+	to 0 as an indicator that this has been done.  With Broyden updates,
+	J is only recomputed by finite differences after a convergence
+	failure, a method switch, or broyden_ updated matrices in a row.
       */
       while(1) {
 	if(*m == 0) {
 	  if(ipup > 0) {
-	    prja(neq, y, f, _data);
+	    if(miter == 2 && !jac_.empty() && jfd_ == 0 && nbrf_ < broyden_)
+	      prjb();
+	    else
+	      prja(neq, y, f, _data);
 	    ipup  = 0;
 	    rc    = 1.;
 	    nslp  = nst;
@@ -1670,6 +2644,7 @@ namespace LSODA {
 	      return;
 	    }
 	  }
+	  LSODA_VECTOR_FOR
 	  for(size_t i = 1; i <= n; i++)
 	    acor[i] = 0.;
 	} /* end if ( *m == 0 )   */
@@ -1678,34 +2653,51 @@ namespace LSODA {
 	    In case of functional iteration, update y directly from
 	    the result of the last function evaluation.
 	  */
+	  LSODA_VECTOR_FOR
 	  for(size_t i = 1; i <= n; i++) {
 	    savf[i] = h_ * savf[i] - yh_[2][i];
 	    y[i]    = savf[i] - acor[i];
 	  }
 	  *del = vmnorm(n, y, ewt);
-	  for(size_t i = 1; i <= n; i++) {
-	    y[i]    = yh_[1][i] + el[1] * savf[i];
-	    acor[i] = savf[i];
+	  if(anderson_ > 0 && andg_.size() == anderson_)
+	    anderson(y, *m);
+	  else {
+	    LSODA_VECTOR_FOR
+	    for(size_t i = 1; i <= n; i++)
+	      acor[i] = savf[i];
 	  }
+	  LSODA_VECTOR_FOR
+	  for(size_t i = 1; i <= n; i++)
+	    y[i] = yh_[1][i] + el[1] * acor[i];
 	}
 	/* end functional iteration   */
 	/*
 	  In the case of the chord method, compute the corrector error,
 	  and solve the linear system with that as right-hand side and
-	  P as coefficient matrix.
+	  P as coefficient matrix.  For a DAE the corrector error is
+	  h_ * f - M * ( yh_[2] + acor ).
 	*/
 	else {
-	  for(size_t i = 1; i <= n; i++)
-	    y[i] = h_ * savf[i] - (yh_[2][i] + acor[i]);
+	  if(mass_.empty()) {
+	    LSODA_VECTOR_FOR
+	    for(size_t i = 1; i <= n; i++)
+	      y[i] = h_ * savf[i] - (yh_[2][i] + acor[i]);
+	  } else {
+	    LSODA_VECTOR_FOR
+	    for(size_t i = 1; i <= n; i++)
+	      y[i] = h_ * savf[i] - mass_[i] * (yh_[2][i] + acor[i]);
+	  }
 
 	  solsy(y);
 	  *del = vmnorm(n, y, ewt);
 
+	  LSODA_VECTOR_FOR
 	  for(size_t i = 1; i <= n; i++) {
 	    acor[i] += y[i];
 	    y[i] = yh_[1][i] + el[1] * acor[i];
 	  }
 	} /* end chord method   */
+	ncor_++;
         /*
 	  Test for convergence.  If *m > 0, an estimate of the convergence
 	  rate constant is stored in crate, and this is used in the test.
@@ -1750,18 +2742,24 @@ namespace LSODA {
 	    return;
 	  }
 	  ipup = miter;
+	  jfd_ = 1;
 	  /*
 	    Restart corrector if Jacobian is recomputed.
 	  */
 	  *m   = 0;
 	  rate = 0.;
 	  *del = 0.;
+	  LSODA_VECTOR_FOR
 	  for(size_t i = 1; i <= n; i++)
 	    y[i] = yh_[1][i];
 
 	  (*f)(tn_, &y[1], &savf[1], _data);
 
 	  nfe++;
+	  if(miter == 2 && !jac_.empty()) {
+	    std::copy(y.begin(), y.end(), bry_.begin());
+	    std::copy(savf.begin(), savf.end(), brf_.begin());
+	  }
 	}
 	/*
 	  Iterate corrector.
@@ -1770,19 +2768,117 @@ namespace LSODA {
 	  *delp = *del;
 	  (*f)(tn_, &y[1], &savf[1], _data);
 	  nfe++;
+	  if(miter == 2 && !jac_.empty())
+	    broydenupdate(y);
 	}
       } /* end while   */
     } /* end correction   */
 
+    /*
+      Anderson acceleration of the functional iteration (miter = 0).  The
+      iteration is acor <- g(acor) = h_ * f(yh_[1] + el[1] * acor) - yh_[2],
+      with residual r = g(acor) - acor.  With the differences dG and dR of
+      the last ( up to anderson_ ) values of g and r in this corrector
+      loop, gamma minimizes the ewt-weighted 2-norm of r - dR * gamma, and
+      the next iterate is acor = g - dG * gamma, in place of g.
+
+      savf holds g and r the residual of iteration m.  The normal
+      equations are solved by Cholesky; if they are singular the plain
+      iterate is taken and the history restarts.
+    */
+    void anderson(const std::vector<double> &r, size_t m)
+    {
+      double a[ANDERSON_MAX][ANDERSON_MAX], b[ANDERSON_MAX], d, wi;
+      size_t i, j, k, nh;
+
+      if(m == 0)
+	nand_ = pand_ = 0;
+      else {
+	for(i = 1; i <= n; i++) {
+	  andg_[pand_][i] = savf[i] - andgp_[i];
+	  andr_[pand_][i] = r[i] - andrp_[i];
+	}
+	pand_ = (pand_ + 1) % anderson_;
+	nand_ = std::min(nand_ + 1, anderson_);
+      }
+      for(i = 1; i <= n; i++) {
+	andgp_[i] = savf[i];
+	andrp_[i] = r[i];
+	acor[i]   = savf[i];
+      }
+      nh = nand_;
+      if(nh == 0)
+	return;
+      for(j = 0; j < nh; j++) {
+	for(k = 0; k <= j; k++)
+	  a[j][k] = 0.;
+	b[j] = 0.;
+      }
+      for(i = 1; i <= n; i++) {
+	wi = ewt[i] * ewt[i];
+	for(j = 0; j < nh; j++) {
+	  d = andr_[j][i] * wi;
+	  for(k = 0; k <= j; k++)
+	    a[j][k] += d * andr_[k][i];
+	  b[j] += d * r[i];
+	}
+      }
+      /* Cholesky factor a = L L', in the lower triangle.  */
+      for(j = 0; j < nh; j++) {
+	d = a[j][j];
+	for(k = 0; k < j; k++)
+	  d -= a[j][k] * a[j][k];
+	if(d <= 1.e-14 * a[j][j] || d <= 0.) {
+	  nand_ = pand_ = 0;
+	  return;
+	}
+	a[j][j] = std::sqrt(d);
+	for(i = j + 1; i < nh; i++) {
+	  d = a[i][j];
+	  for(k = 0; k < j; k++)
+	    d -= a[i][k] * a[j][k];
+	  a[i][j] = d / a[j][j];
+	}
+      }
+      for(j = 0; j < nh; j++) {
+	for(k = 0; k < j; k++)
+	  b[j] -= a[j][k] * b[k];
+	b[j] /= a[j][j];
+      }
+      for(j = nh; j-- > 0;) {
+	for(k = j + 1; k < nh; k++)
+	  b[j] -= a[k][j] * b[k];
+	b[j] /= a[j][j];
+      }
+      for(j = 0; j < nh; j++)
+	for(i = 1; i <= n; i++)
+	  acor[i] -= b[j] * andg_[j][i];
+    }
+
+    /*
+      Multiply the yh_ array by the Pascal triangle matrix to predict the
+      step ( inverse = false ), or by its inverse to retract it after a
+      failure.  The loop over the states is outermost, for the threads.
+    */
+    void pascal(bool inverse)
+    {
+      LSODA_VECTOR_FOR
+      for(size_t i = 1; i <= n; i++)
+	for(size_t j = nq; j >= 1; j--)
+	  for(size_t i1 = j; i1 <= nq; i1++)
+	    if(inverse)
+	      yh_[i1][i] -= yh_[i1 + 1][i];
+	    else
+	      yh_[i1][i] += yh_[i1 + 1][i];
+    }
+
     void corfailure(double *told, double *rh, size_t *ncf, size_t *corflag)
     {
       (*ncf)++;
+      dsmlast_ = 0.;
       rmax = 2.;
       tn_  = *told;
-      for(size_t j = nq; j >= 1; j--)
-	for(size_t i1 = j; i1 <= nq; i1++)
-	  for(size_t i = 1; i <= n; i++)
-	    yh_[i1][i] -= yh_[i1 + 1][i];
+      pascal(true);
 
       if(std::abs(h_) <= hmin * 1.00001 || *ncf == mxncf) {
 	*corflag = 2;
@@ -1791,13 +2887,15 @@ namespace LSODA {
       *corflag = 1;
       *rh      = 0.25;
       ipup     = miter;
+      jfd_     = 1;
     }
 
     /*
       This routine manages the solution of the linear system arising from
       a chord iteration.  It is called if miter != 0.
-      If miter is 2, it calls dgesl to accomplish this.
+      If miter is 1 or 2, it calls dgesl to accomplish this.
       If miter is 5, it calls dgbsl.
+      If miter is 7, it calls dgesl for each diagonal block.
 
       y = the right-hand side vector on input, and the solution vector
       on output.
@@ -1805,12 +2903,20 @@ namespace LSODA {
     void solsy(std::vector<double> &y)
     {
       iersl = 0;
-      if(miter != 2) {
-	REprintf("solsy -- miter != 2\n");
+      if(miter != 1 && miter != 2 && miter != 5 && miter != 7) {
+	eprintf("solsy -- miter != 1, 2, 5 or 7\n");
 	return;
       }
-      if(miter == 2)
+      if(miter == 1 || miter == 2)
 	dgesl(wm_, n, ipvt, y, 0);
+      if(miter == 5)
+	dgbsl(wb_, n, ml, mu, ipvt, y);
+      if(miter == 7)
+	for(size_t b = 0; b < n / mb; b++) {
+	  std::copy(y.begin() + b * mb + 1, y.begin() + (b + 1) * mb + 1, wdtmp_.begin() + 1);
+	  dgesl(wd_[b], mb, ipvtd_[b], wdtmp_, 0);
+	  std::copy(wdtmp_.begin() + 1, wdtmp_.end(), y.begin() + b * mb + 1);
+	}
       return;
     }
 
@@ -1939,6 +3045,7 @@ namespace LSODA {
     void endstoda()
     {
       double r = 1. / tesco[nqu][2];
+      LSODA_VECTOR_FOR
       for(size_t i = 1; i <= n; i++)
 	acor[i] *= r;
       hold   = h_;
@@ -1968,6 +3075,14 @@ namespace LSODA {
 
       exsm = 1. / (double)l;
       rhsm = 1. / (1.2 * pow(dsm, exsm) + 0.0000012);
+      /*
+	The PI controller ( Gustafsson ) also uses the error estimate of the
+	previous step, if accepted at the same order: a growing error damps
+	an increase of h_, and a falling error allows more.
+      */
+      if(controller_ == 2 && kflag == 0 && dsmold_ > 0.)
+	rhsm = 1. / (1.2 * pow(dsm, 0.7 * exsm) * pow(std::max(dsmold_, 1.e-4), -0.4 * exsm) +
+		     0.0000012);
 
       rhdn = 0.;
       if(nq != 1) {
@@ -2073,11 +3188,526 @@ namespace LSODA {
       conit = 0.5 / (double)(nq + 2);
     }
 
+    /*
+      Convert f values held in v to scaled derivatives r * y'.  For an
+      ODE this is r * f.  For a DAE M y' = f with diagonal M, y' = f / M
+      for the differential components, and the algebraic components
+      ( M[i] = 0 ) are given a zero derivative.
+    */
+    void massscale(std::vector<double> &v, double r)
+    {
+      if(mass_.empty()) {
+	if(r != 1.)
+	  for(size_t i = 1; i <= n; i++)
+	    v[i] *= r;
+	return;
+      }
+      for(size_t i = 1; i <= n; i++)
+	v[i] = (mass_[i] != 0.) ? r * v[i] / mass_[i] : 0.;
+    }
+
     void _freevectors(void)
     {
       // Does nothing. USE c++ memory mechanism here.
     }
 
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Solve a semi-explicit DAE M y' = f(t, y) with a constant
+     * diagonal mass matrix M.  Components with M[i] = 0 are algebraic
+     * constraints 0 = f[i](t, y), which are solved exactly by the bdf
+     * corrector rather than through a stiff penalty.  The initial values
+     * should be consistent.  An empty vector gives back an ODE.
+     *
+     * @Param mass, diagonal of M, of size neq.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_mass(const std::vector<double> &mass)
+    {
+      mass_.clear();
+      if(mass.empty())
+	return;
+      mass_.resize(mass.size() + 1, 0.0);
+      std::copy(mass.begin(), mass.end(), mass_.begin() + 1);
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Set the Jacobian type used by lsoda_function() when the
+     * stiff method is selected.
+     *
+     * @Param jt, 2 for a full matrix, 5 for a banded matrix, or 6 to detect
+     * the sparsity pattern from f before the first step and choose a full,
+     * banded or column-grouped finite difference Jacobian.  Grouping
+     * only cuts the calls to f per Jacobian: the iteration matrix is still
+     * stored and factored as a full matrix.
+     * @Param ml, lower half-bandwidth for jt = 5.
+     * @Param mu, upper half-bandwidth for jt = 5.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_jacobian(int jt, size_t ml = 0, size_t mu = 0)
+    {
+      jt_ = jt;
+      ml_ = ml;
+      mu_ = mu;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Use a full Jacobian computed by the user (jt = 1) rather
+     * than by finite differences.
+     *
+     * @Param jac, function setting pd[i + neq * j] to df_i / dy_j.
+     * @Param data, passed to jac, which may differ from that passed to f.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_jacobian_function(LSODA_JAC_TYPE jac, void *data = nullptr)
+    {
+      jt_      = 1;
+      jacfn_   = jac;
+      jacdata_ = data;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Use a block-diagonal Jacobian (jt = 7), for a state vector
+     * that packs neq / mb uncoupled subsystems of size mb.  Each Jacobian
+     * then costs mb calls to f and one LU decomposition per block, which
+     * is linear rather than cubic in the number of subsystems.
+     *
+     * @Param mb, block size, which should divide neq.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_jacobian_blocks(size_t mb)
+    {
+      jt_ = 7;
+      mb_ = mb;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Enable Broyden updates of a full (or grouped) Jacobian.
+     * The stored J gets a rank-one update from each corrector iteration,
+     * and when the iteration matrix is due for reevaluation it is formed
+     * from the updated J, without calls to f.  J is recomputed by finite
+     * differences after a convergence failure or a method switch, and in
+     * any case after maxupd updated matrices in a row.
+     *
+     * @Param maxupd, maximum number of consecutive updated matrices, or
+     * 0 (the default) to always use finite differences.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_broyden(size_t maxupd)
+    {
+      broyden_ = maxupd;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Also return the first nd derivatives of the solution at
+     * the output times from ode(), from the Nordsieck array as interpolated
+     * by intdy, so without further calls to f.
+     *
+     * @Param nd, 0 (the default), 1 for dy/dt or 2 for dy/dt and d2y/dt2.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_derivatives(size_t nd)
+    {
+      if(nd > 2) Rcpp::stop("set_derivatives: nd should be 0, 1 or 2");
+      nderiv_ = nd;
+    }
+
+    size_t derivatives() const
+    {
+      return nderiv_;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Select the columns returned by ode(), and the components
+     * of y interpolated by intdy at the output times.  If only states are
+     * selected, the other components of y returned by lsoda() are not
+     * updated; if an output of f is selected, all states are interpolated,
+     * as f needs them.
+     *
+     * @Param idx, 0-based indices of the states (0 to neq - 1) and then of
+     * the further outputs of f (neq to nout - 1); empty for all.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_output_indices(const std::vector<size_t> &idx)
+    {
+      keep_ = idx;
+    }
+
+    const std::vector<size_t> &output_indices() const
+    {
+      return keep_;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Choose the weighted norm of the error, convergence and
+     * stiffness tests.  The max norm lets the worst component set the step
+     * size; the root-mean-square norm, as in CVODE and DASSL, averages
+     * over the components, which for large systems allows larger steps at
+     * the same tolerances, with the errors controlled on average.
+     *
+     * @Param norm, 1 for the max norm (the default) or 2 for the
+     * root-mean-square norm.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_norm(int norm)
+    {
+      if(norm != 1 && norm != 2) Rcpp::stop("set_norm: norm should be 1 (max) or 2 (rms)");
+      norm_ = norm;
+    }
+
+    int norm() const
+    {
+      return norm_;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Choose how the first step size is computed, when not given
+     * in rworks[0]: 1 for lsoda's formula from the tolerance, the length
+     * of the interval and norm(f) (the default), or 2 for the Hairer-Wanner
+     * algorithm, which estimates the second derivative with one more call
+     * to f ( see initialstep() ).
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_initial_step(int method)
+    {
+      if(method != 1 && method != 2)
+	Rcpp::stop("set_initial_step: method should be 1 (lsoda) or 2 (Hairer-Wanner)");
+      h0method_ = method;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Run the vector kernels of the solver ( prediction, the
+     * corrector updates, the weighted norms, ewset, scaleh and intdy ) on
+     * OpenMP threads for systems of at least threshold equations; smaller
+     * systems stay serial, where the threads cost more than they save.
+     * The linear algebra and f are not affected ( see Partition for f ).
+     * The results do not depend on the number of threads, except with the
+     * rms norm, whose sum is reduced in a different order.  Takes effect at
+     * the next istate = 1, and has no effect without OpenMP.
+     *
+     * @Param threads, number of threads, 1 (the default) for none, or 0 for
+     * the OpenMP default.
+     * @Param threshold, smallest number of equations for threads.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_threads(int threads, size_t threshold = 10000)
+    {
+      if(threads < 0)
+	Rcpp::stop("set_threads: threads should be >= 0");
+#ifdef _OPENMP
+      threads_ = (threads == 0) ? omp_get_max_threads() : threads;
+#else
+      threads_ = 1;
+#endif
+      vmin_ = threshold;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Set the heuristic constants of the step ( see Heuristics ),
+     * which take effect at the next istate = 1.  The best values depend on
+     * the problem: e.g. a larger ccmax and msbp form fewer iteration
+     * matrices at the cost of more corrector iterations.  Tuner chooses
+     * them from the cost of repeated solves.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_heuristics(const Heuristics &heur)
+    {
+      if(!(heur.ccmax > 0.))
+	Rcpp::stop("set_heuristics: ccmax should be > 0");
+      if(heur.msbp < 1 || heur.maxcor < 1 || heur.mxncf < 1)
+	Rcpp::stop("set_heuristics: msbp, maxcor and mxncf should be >= 1");
+      if(!(heur.ratio >= 1.))
+	Rcpp::stop("set_heuristics: ratio should be >= 1");
+      heur_ = heur;
+    }
+
+    const Heuristics &heuristics() const
+    {
+      return heur_;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Accelerate the functional iteration of the Adams corrector
+     * ( nonstiff mode ) by Anderson mixing of the last window iterates
+     * ( see anderson() ).  The corrector then converges in more mildly
+     * stiff regions, which saves step size reductions and switches to
+     * BDF.  At most maxcor iterates are taken ( 3 by default, see
+     * set_heuristics() ), so that a window above maxcor - 1 has no effect.
+     * Call before the first step: the history is allocated with the work
+     * space.
+     *
+     * @Param window, 0 (the default) for plain functional iteration, or 1
+     * to ANDERSON_MAX.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_anderson(size_t window)
+    {
+      if(window > ANDERSON_MAX)
+	Rcpp::stop("set_anderson: window should be at most " + std::to_string(ANDERSON_MAX));
+      anderson_ = window;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Choose the step size controller used after a successful
+     * step.  The classical controller sets the ratio of the new to the old
+     * step size from the error estimate of the step alone, as
+     * 1 / ( 1.2 * dsm^(1/l) ); the PI controller ( Gustafsson 1991 ) uses
+     * 1 / ( 1.2 * dsm^(0.7/l) * dsmold^(-0.4/l) ) with the estimate dsmold of
+     * the previous step, which smooths the step size sequence and avoids
+     * cycles of increases and rejections.  Steps after a rejection ( by the
+     * error test or the corrector ), an order change or a method switch use
+     * the classical rule.
+     *
+     * @Param controller, 1 for the classical controller (the default) or 2
+     * for the PI controller.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_controller(int controller)
+    {
+      if(controller != 1 && controller != 2)
+	Rcpp::stop("set_controller: controller should be 1 (classical) or 2 (PI)");
+      controller_ = controller;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Record each attempted step of stoda ( see TraceEntry ),
+     * in a buffer allocated here that keeps the last capacity attempts.
+     * The trace restarts with each new problem ( istate = 1 ).
+     *
+     * @Param capacity, number of attempts kept, or 0 (the default) to
+     * record nothing.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_trace(size_t capacity)
+    {
+      trace_.assign(capacity, TraceEntry());
+      ntrace_ = 0;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Record the accepted steps of each solve ( StepRecord ),
+     * from istate = 1, for set_replay().
+     *
+     * @Param record, whether to record.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_record(bool record)
+    {
+      record_ = record;
+      steps_.clear();
+    }
+
+    bool recording() const
+    {
+      return record_;
+    }
+
+    // the steps recorded in the last solve
+    const std::vector<StepRecord> &recorded() const
+    {
+      return steps_;
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Replay a step sequence recorded by set_record() in the
+     * following solves: each step takes the recorded step size, order and
+     * method, and is accepted without the error test, so that the
+     * solutions of a problem with slightly changed parameters ( for finite
+     * difference gradients ) have no jumps from changes of the steps, and
+     * cost no error estimates or rejected steps.  The accuracy is then that
+     * of the recorded solve.  The number of corrector iterations and the
+     * Jacobian evaluations still adapt to the problem, so a replay with the
+     * recorded parameters differs from the recorded solve by up to about
+     * the tolerance, and small jumps remain where they change: difference
+     * replays only ( including one with the recorded parameters ), not a
+     * replay and the recorded solve.  If the corrector fails to converge
+     * on a step, or the recorded steps end before the last output time,
+     * the solve goes on adaptively from there; statistics()["nrp"] is the
+     * number of steps replayed.  The solves should start at the same time
+     * as the one recorded.
+     *
+     * @Param steps, the steps from recorded(), or empty to replay nothing.
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_replay(const std::vector<StepRecord> &steps)
+    {
+      for(size_t k = 0; k < steps.size(); k++) {
+	if(steps[k].method != 1 && steps[k].method != 2)
+	  Rcpp::stop("set_replay: method should be 1 (Adams) or 2 (BDF)");
+	if(steps[k].order < 1 || steps[k].order > (steps[k].method == 1 ? 12 : 5))
+	  Rcpp::stop("set_replay: order should be 1 to 12 for Adams and 1 to 5 for BDF");
+	if(!(steps[k].h != 0.) || !std::isfinite(steps[k].h))
+	  Rcpp::stop("set_replay: h should be finite and non-zero");
+      }
+      replay_ = steps;
+      rpos_   = replay_.size();
+    }
+
+    /* --------------------------------------------------------------------------*/
+    /**
+     * @Synopsis  Restore the settings of a new solver ( those of the set_
+     * functions above ), keeping the work space, so that the solver can be
+     * reused for another problem without allocating ( SolverPool ).
+     */
+    /* ----------------------------------------------------------------------------*/
+    void set_defaults()
+    {
+      mass_.clear();
+      jt_ = 2;
+      ml_ = mu_ = mb_ = 0;
+      jacfn_   = nullptr;
+      jacdata_ = nullptr;
+      broyden_ = nderiv_ = anderson_ = 0;
+      keep_.clear();
+      norm_ = h0method_ = controller_ = 1;
+      threads_ = 1;
+      vmin_    = 10000;
+      heur_    = Heuristics();
+      trace_.clear();
+      ntrace_ = 0;
+      jcolptr_.clear();
+      jrowind_.clear();
+      jgptr_.clear();
+      jgcol_.clear();
+      record_ = false;
+      steps_.clear();
+      replay_.clear();
+    }
+
+    /*
+      The attempts recorded, oldest first.
+    */
+    std::vector<TraceEntry> trace() const
+    {
+      std::vector<TraceEntry> res;
+      size_t k, cap = trace_.size(), first = (ntrace_ > cap) ? ntrace_ - cap : 0;
+      for(k = first; k < ntrace_; k++)
+	res.push_back(trace_[k % cap]);
+      return res;
+    }
+
+    /*
+      The number of attempts recorded in all, including those overwritten.
+    */
+    size_t trace_total() const
+    {
+      return ntrace_;
+    }
+
+    /*
+      The k-th derivative of the solution at t, which should be within the
+      last step taken, into dky[0..neq-1].  The components are NA if k is
+      larger than the order nq of the last step, or if no step was taken.
+    */
+    void derivative(double t, int k, std::vector<double> &dky)
+    {
+      int iflag = 0;
+
+      dky.resize(n);
+      if(nst == 0 || k > (int)nq) {
+	std::fill(dky.begin(), dky.end(), NA_REAL);
+	return;
+      }
+      dky_.resize(n + 1);
+      intdy(t, k, dky_, &iflag);
+      if(iflag != 0)
+	std::fill(dky_.begin(), dky_.end(), NA_REAL);
+      std::copy(dky_.begin() + 1, dky_.end(), dky.begin());
+    }
+
+    /*
+      Append the Nordsieck array of the last step to dense output.
+    */
+    void dense_append(DenseOutput &dense) const
+    {
+      dense.neq = n;
+      dense.append(tn_, h_, hu, nq, yh_);
+    }
+
+    /*
+      Convert f(t, y) in ydot[0..neq-1] to dy/dt, which for a DAE divides
+      by the mass matrix diagonal, with NA for the algebraic components.
+    */
+    void massdivide(std::vector<double> &ydot) const
+    {
+      if(mass_.empty())
+	return;
+      for(size_t i = 1; i < mass_.size(); i++)
+	ydot[i - 1] = (mass_[i] == 0.) ? NA_REAL : ydot[i - 1] / mass_[i];
+    }
+
+    /*
+      Structure of the Jacobian in use: "dense", "banded", "grouped" or
+      "block-diagonal".  A "grouped" Jacobian is a full one computed by
+      column-grouped finite differences; it is factored by dgefa as a
+      dense matrix.
+    */
+    std::string jacobian_type() const
+    {
+      if(jtyp == 7)
+	return "block-diagonal";
+      if(jtyp == 4 || jtyp == 5)
+	return "banded";
+      if(!jgptr_.empty())
+	return "grouped";
+      return "dense";
+    }
+
+    /*
+      Solver statistics, as the optional outputs of lsoda: the number of
+      steps (nst), f evaluations (nfe) and Jacobian evaluations (nje), the
+      last step size (hu), order (nqu) and method (mused) used, the
+      Jacobian type (jt), its half-bandwidths (ml, mu), the number of
+      column groups for a grouped Jacobian (ngroups), the block size for
+      a block-diagonal Jacobian (blocksize), the number of iteration
+      matrices formed from a Broyden updated Jacobian (nbu) and the first
+      negative istate of the solve, or 0 (istate, as failure()).
+    */
+    std::map<std::string, double> statistics() const
+    {
+      std::map<std::string, double> stats;
+      stats["nst"]     = nst;
+      stats["nfe"]     = nfe;
+      stats["nje"]     = nje;
+      stats["hu"]      = hu;
+      stats["nqu"]     = nqu;
+      stats["mused"]   = mused;
+      stats["jt"]      = jtyp;
+      stats["ml"]      = (jtyp == 4 || jtyp == 5) ? ml : 0;
+      stats["mu"]      = (jtyp == 4 || jtyp == 5) ? mu : 0;
+      stats["ngroups"] = jgptr_.empty() ? 0 : jgptr_.size() - 1;
+      stats["blocksize"] = (jtyp == 7) ? mb : 0;
+      stats["nbu"]     = nbu;
+      stats["nsw"]     = nsw_;
+      stats["nrp"]     = nrp_;
+      stats["istate"]  = failed_;
+      return stats;
+    }
+
+    /*
+      The first negative istate returned by lsoda_function() since it was
+      last called with istate = 1, or 0 if the solve has not failed.
+    */
+    int failure() const
+    {
+      return failed_;
+    }
+
     /* --------------------------------------------------------------------------*/
     /**
      * @Synopsis  Simpler interface.
@@ -2091,41 +3721,47 @@ namespace LSODA {
      * @Param _data
      * @Param rtol, relative tolerance.
      * @Param atol, absolute tolerance.
+     * @Param itask, 1 to stop at tout ( the default ), or 2 to take one step.
      */
     /* ----------------------------------------------------------------------------*/
     void lsoda_function(LSODA_ODE_SYSTEM_TYPE f, const size_t neq,
 			std::vector<double> &y,
 			std::vector<double> &yout, double *t,
 			const double tout, int *istate, void *_data,
-			double rtol, double atol)
+			double rtol, double atol, int itask = 1)
     {
       std::array<int, 7> iworks    = {{0}};
       std::array<double, 4> rworks = {{0.0}};
 
-      int itask, iopt, jt;
+      int iopt, jt;
 
-      itask = 1;
       iopt  = 0;
-      jt    = 2;
+      jt    = jt_;
+      iworks[0] = (int)((jt_ == 7) ? mb_ : ml_);
+      iworks[1] = (int)mu_;
 
       // lsoda() uses 1-indexing
       yout.resize(y.size()+1); // is this needed?
       yout[0] = 0.0;
       std::copy(y.begin(), y.end(), yout.begin()+1);
     
-      // Set the tolerance. We should do it only once.
-      rtol_.resize(neq + 1, rtol);
-      atol_.resize(neq + 1, atol);
+      // Set the tolerance ( anew, for a solver reused with others ).
+      rtol_.assign(neq + 1, rtol);
+      atol_.assign(neq + 1, atol);
       rtol_[0] = 0;
       atol_[0] = 0;
 
+      if(*istate == 1)
+	failed_ = 0;
       lsoda(f, neq, yout, t, tout, itask, istate, iopt, jt, iworks, rworks, _data);
+      if(*istate < 0 && failed_ == 0)
+	failed_ = *istate;
     
       yout.erase(yout.begin()); // lsoda() uses 1-indexing
     }
 
   private:
-    size_t ml, mu, imxer;
+    size_t ml = 0, mu = 0, mb = 0, imxer;
     double sqrteta;
 
     // NOTE: initialize in default constructor. Older compiler e.g. 4.8.4 would
@@ -2145,15 +3781,15 @@ namespace LSODA {
 
     int kflag, jstart, iret;
 
-    size_t ixpr = 0, jtyp, mused, mxordn, mxords = 12;
+    size_t ixpr = 0, jtyp = 2, mused = 0, mxordn, mxords = 12;
     size_t meth_;
 
-    size_t n, nq, nst, nfe, nje, nqu;
+    size_t n, nq, nst = 0, nfe = 0, nje = 0, nqu = 0, nbu = 0, nsw_ = 0;
     size_t mxstep, mxhnil;
     size_t nslast, nhnil, ntrep, nyh;
 
     double ccmax, el0, h_ = .0;
-    double hmin, hmxi, hu, rc, tn_ = 0.0;
+    double hmin, hmxi, hu = 0.0, rc, tn_ = 0.0;
     double tsw, pdnorm;
     double conit, crate, hold, rmax;
 
@@ -2167,9 +3803,81 @@ namespace LSODA {
     std::vector<double> acor;
     std::vector<std::vector<double>> yh_;
     std::vector<std::vector<double>> wm_;
+    std::vector<std::vector<double>> wb_; // band matrix for miter = 5
+    std::vector<std::vector<std::vector<double>>> wd_; // blocks for miter = 7
+    std::vector<std::vector<int>> ipvtd_;
+    std::vector<double> wdtmp_;
 
     std::vector<int> ipvt;
 
+    std::vector<double> mass_; // DAE mass matrix diagonal, 1-based
+
+    // Jacobian type for lsoda_function(), and the pattern found for jt = 6
+    int jt_ = 2;
+    size_t ml_ = 0, mu_ = 0, mb_ = 0;
+    std::vector<size_t> jcolptr_, jrowind_;
+    std::vector<size_t> jgptr_, jgcol_;
+
+    // user-supplied Jacobian for jt = 1
+    LSODA_JAC_TYPE jacfn_ = nullptr;
+    void *jacdata_ = nullptr;
+    std::vector<double> jacpd_;
+
+    // derivatives returned by ode(), and a 1-based buffer for intdy
+    size_t nderiv_ = 0;
+    std::vector<double> dky_;
+
+    // columns selected for ode(), and the ( 1-based ) states interpolated
+    // by intdy, or empty for all
+    std::vector<size_t> keep_, iout_;
+
+    // Broyden updates: J, the last corrector iterate and its f value
+    size_t broyden_ = 0, nbrf_ = 0, jfd_ = 1;
+    std::vector<std::vector<double>> jac_;
+    std::vector<double> bry_, brf_;
+
+    // weighted norm: 1 for max, 2 for root-mean-square
+    int norm_ = 1;
+
+    // step size controller: 1 for classical, 2 for PI, with the error
+    // estimates of the last two accepted steps ( 0 if none )
+    int controller_ = 1;
+    double dsmold_ = 0., dsmlast_ = 0.;
+
+    // initial step size: 1 for lsoda's formula, 2 for Hairer-Wanner
+    int h0method_ = 1;
+
+    // heuristic constants, copied into ccmax etc. at istate = 1
+    Heuristics heur_;
+
+    // vector kernels: the threads, the smallest system run on them, and
+    // whether this one is
+    int threads_ = 1;
+    size_t vmin_ = 10000;
+    bool vpar_ = false;
+
+    // Anderson acceleration: the window, the differences of g and of the
+    // residual ( a ring of anderson_ ), the last g and residual, the next
+    // slot and the number of differences held
+    size_t anderson_ = 0, pand_ = 0, nand_ = 0;
+    std::vector<std::vector<double>> andg_, andr_;
+    std::vector<double> andgp_, andrp_;
+
+    // step trace: a ring buffer of the last attempts, the number recorded,
+    // and the corrector iterations of the current attempt
+    std::vector<TraceEntry> trace_;
+    size_t ntrace_ = 0, ncor_ = 0;
+
+    // step sequence: whether the accepted steps are recorded, and those
+    // recorded; the steps to replay, the next of them ( replay_.size()
+    // when not replaying ), and the number replayed
+    bool record_ = false;
+    std::vector<StepRecord> steps_, replay_;
+    size_t rpos_ = 0, nrp_ = 0;
+
+    // the first failure of the solve, for failure()
+    int failed_ = 0;
+
   private:
     int itol_ = 2;
     std::vector<double> rtol_;
@@ -2180,48 +3888,329 @@ namespace LSODA {
 
   }; // LSODA class
 
+  /*
+    Tuner of the heuristic constants over repeated solves of one model
+    ( an ensemble, or the objective of an optimiser ).  Before each solve
+    next() gives the constants to try, and after it report() gives the
+    cost of the solve, nfe + jacweight * ( nje + nbu ): the f evaluations
+    ( including those for the Jacobian ) plus the iteration matrices formed
+    and factored, each weighted as jacweight calls of f ( by default neq ).
+    The cost of a failed solve is infinite.
+
+    The search is a compass search on grids of ccmax, msbp, maxcor and
+    ratio, from the defaults: the cost of each setting is the mean over
+    batch solves, a neighbouring setting ( one grid step in one constant )
+    replaces the current one if its cost is at least 1% lower, and the
+    search stops when no neighbour is better, after which next() gives the
+    best setting.  mxncf, a failure limit rather than a cost, is left alone.
+  */
+  class Tuner {
+  public:
+    Tuner(double jacweight = -1., size_t batch = 3)
+      : jacweight_(jacweight), batch_(std::max(batch, (size_t) 1)) {
+      for(size_t p = 0; p < NP; p++)
+	cur_[p] = cand_[p] = grid(p, -1);
+    }
+
+    // the constants for the next solve
+    Heuristics next() const
+    {
+      return setting(done_ ? cur_ : cand_);
+    }
+
+    /*
+      The cost of the solve with the constants from next(), given the
+      first negative istate of the solve ( or 0 ).  A failed solve stops
+      early and so is cheap: its cost is infinite, so that its setting is
+      never chosen.
+    */
+    void report(const LSODA &solver, size_t neq, int istate)
+    {
+      if(istate < 0) {
+	report(std::numeric_limits<double>::infinity());
+	return;
+      }
+      std::map<std::string, double> stats = solver.statistics();
+      double w = (jacweight_ < 0.) ? (double) neq : jacweight_;
+      report(stats["nfe"] + w * (stats["nje"] + stats["nbu"]));
+    }
+
+    void report(double cost)
+    {
+      nsolves_++;
+      if(done_)
+	return;
+      sum_ += cost;
+      if(++count_ < batch_)
+	return;
+      double mean = sum_ / (double) count_;
+      sum_   = 0.;
+      count_ = 0;
+      if(curcost_ < 0. || mean < 0.99 * curcost_) {
+	if(curcost_ >= 0.)
+	  nmoves_++;
+	for(size_t p = 0; p < NP; p++)
+	  cur_[p] = cand_[p];
+	curcost_ = mean;
+	neighbours();
+      }
+      if(queue_.empty()) {
+	done_ = true;
+	return;
+      }
+      for(size_t p = 0; p < NP; p++)
+	cand_[p] = queue_.back()[p];
+      queue_.pop_back();
+    }
+
+    // the best constants found so far, and their mean cost ( -1 if none )
+    Heuristics best() const
+    {
+      return setting(cur_);
+    }
+
+    double cost() const
+    {
+      return curcost_;
+    }
+
+    bool converged() const
+    {
+      return done_;
+    }
+
+    size_t solves() const
+    {
+      return nsolves_;
+    }
+
+    size_t moves() const
+    {
+      return nmoves_;
+    }
+
+  private:
+    static const size_t NP = 4; // ccmax, msbp, maxcor, ratio
+
+    // grid point k of constant p, or the index of its default for k < 0
+    static double grid(size_t p, int k)
+    {
+      static const double ccmax[] = {0.1, 0.2, 0.3, 0.5, 0.8};
+      static const double msbp[] = {5, 10, 20, 40, 80};
+      static const double maxcor[] = {2, 3, 4, 5};
+      static const double ratio[] = {2, 3, 5, 8};
+      static const double *grids[] = {ccmax, msbp, maxcor, ratio};
+      static const int defaults[] = {2, 2, 1, 2};
+      return (k < 0) ? defaults[p] : grids[p][k];
+    }
+
+    static int size(size_t p)
+    {
+      static const int sizes[] = {5, 5, 4, 4};
+      return sizes[p];
+    }
+
+    Heuristics setting(const int *k) const
+    {
+      Heuristics h;
+      h.ccmax  = grid(0, k[0]);
+      h.msbp   = (size_t) grid(1, k[1]);
+      h.maxcor = (size_t) grid(2, k[2]);
+      h.ratio  = grid(3, k[3]);
+      return h;
+    }
+
+    // the neighbours of cur_ still to try, the first at the back
+    void neighbours()
+    {
+      queue_.clear();
+      for(size_t p = NP; p-- > 0;)
+	for(int d = 1; d >= -1; d -= 2) {
+	  int k = cur_[p] + d;
+	  if(k < 0 || k >= size(p))
+	    continue;
+	  std::array<int, NP> n;
+	  for(size_t q = 0; q < NP; q++)
+	    n[q] = cur_[q];
+	  n[p] = k;
+	  queue_.push_back(n);
+	}
+    }
+
+    double jacweight_;
+    size_t batch_, count_ = 0, nsolves_ = 0, nmoves_ = 0;
+    double sum_ = 0., curcost_ = -1.;
+    int cur_[NP], cand_[NP];
+    std::vector<std::array<int, NP> > queue_;
+    bool done_ = false;
+  };
+
+  // data for func_trunc(): func, neq, nout, its data, and work space for
+  // y and ydot of length nout each, so that no call allocates
+  typedef std::tuple<LSODA_ODE_SYSTEM_TYPE,size_t,size_t,void*,std::vector<double> > TruncTuple;
+
+  inline
+  TruncTuple func_trunc_data(LSODA_ODE_SYSTEM_TYPE func, size_t neq, size_t nout, void* data) {
+    return TruncTuple{func, neq, nout, data, std::vector<double>(2*nout)};
+  }
+
   // call func for neq arguments
   inline
   void func_trunc(double t, double* y, double* ydot, void* data) {
-    using Tuple = std::tuple<LSODA_ODE_SYSTEM_TYPE,size_t,size_t,void*>;
-    Tuple* tuple = static_cast<Tuple*>(data);
+    TruncTuple* tuple = static_cast<TruncTuple*>(data);
     LSODA_ODE_SYSTEM_TYPE func = std::get<0>(*tuple);
     size_t neq = std::get<1>(*tuple);
     size_t nout = std::get<2>(*tuple);
     void* nested_data = std::get<3>(*tuple);
-    std::vector<double> yv(y,y+neq), ydotv(nout);
-    yv.resize(nout);
-    (*func)(t,&yv[0],&ydotv[0],nested_data);
-    std::copy(ydotv.begin(), ydotv.begin()+neq, ydot);
+    double* yv = &std::get<4>(*tuple)[0];
+    double* ydotv = yv + nout;
+    std::copy(y, y+neq, yv);
+    std::fill(yv+neq, yv+nout, 0.0);
+    (*func)(t,yv,ydotv,nested_data);
+    std::copy(ydotv, ydotv+neq, ydot);
   }
   
-  // utility wrapper
-  template<class Vector>
-  Rcpp::NumericMatrix ode(Vector y,
-			  Vector times,
-			  LSODA_ODE_SYSTEM_TYPE func,
-			  size_t nout = 0, // default value => y.size()
-			  void* data = (void*) nullptr,
-			  double rtol=1e-6, double atol = 1e-6) {
+  // the metrics registry of this library ( lsoda_metrics.h )
+  inline Metrics &metrics() {
+    static Metrics registry;
+    return registry;
+  }
+
+  // add a solve from start, which ended with istate, to metrics()
+  inline
+  void metrics_record(const std::map<std::string, double> &stats, int istate,
+		      std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+    metrics().record((size_t) stats.at("nst"), (size_t) stats.at("nfe"), (size_t) stats.at("nje"),
+		     (size_t) stats.at("nsw"), istate, wall.count());
+  }
+
+  /*
+    Result sinks for ode_sink(): init() is called once with the size of
+    the results, set() for each value, and finish() with the column names
+    and the solver statistics.  MatrixSink keeps doubles in a
+    NumericMatrix; FloatSink keeps 32-bit floats in a raw vector of class
+    "lsoda_float", with attributes dims and colnames, at half the memory;
+    VectorSink keeps them in a Solution, without R objects, for solves on
+    other threads than R's.
+  */
+  struct MatrixSink {
+    Rcpp::NumericMatrix res;
+    void init(size_t nrow, size_t ncol) {
+      res = Rcpp::NumericMatrix(nrow, ncol);
+    }
+    void set(size_t i, size_t j, double x) {
+      res(i,j) = x;
+    }
+    void finish(const std::vector<std::string> &nms, const std::map<std::string, double> &stats) {
+      colnames(res) = Rcpp::wrap(nms);
+      res.attr("stats") = Rcpp::wrap(stats);
+    }
+  };
+
+  struct FloatSink {
+    Rcpp::RawVector res;
+    size_t nrow = 0;
+    void init(size_t nrow, size_t ncol) {
+      this->nrow = nrow;
+      res = Rcpp::RawVector(nrow * ncol * sizeof(float));
+      res.attr("dims") = Rcpp::IntegerVector::create(nrow, ncol);
+    }
+    void set(size_t i, size_t j, double x) {
+      float f = (float) x;
+      std::memcpy(&res[(i + nrow * j) * sizeof(float)], &f, sizeof(float));
+    }
+    void finish(const std::vector<std::string> &nms, const std::map<std::string, double> &stats) {
+      res.attr("colnames") = Rcpp::wrap(nms);
+      res.attr("stats") = Rcpp::wrap(stats);
+      res.attr("class") = "lsoda_float";
+    }
+  };
+
+  /*
+    Results of ode() in plain C++ types: values is the nrow x ncol matrix
+    by columns, istate the first negative istate of the solve ( 0 if it
+    did not fail; the rows after a failure repeat the last values ), and
+    messages the diagnostics captured on a worker thread.
+  */
+  struct Solution {
+    size_t nrow = 0, ncol = 0;
+    std::vector<double> values;
+    std::vector<std::string> colnames;
+    std::map<std::string, double> stats;
+    int istate = 0;
+    std::string messages;
+    double operator()(size_t i, size_t j) const {
+      return values[i + nrow * j];
+    }
+  };
+
+  struct VectorSink {
+    Solution res;
+    void init(size_t nrow, size_t ncol) {
+      res.nrow = nrow;
+      res.ncol = ncol;
+      res.values.assign(nrow * ncol, 0.0);
+    }
+    void set(size_t i, size_t j, double x) {
+      res.values[i + res.nrow * j] = x;
+    }
+    void finish(const std::vector<std::string> &nms, const std::map<std::string, double> &stats) {
+      res.colnames = nms;
+      res.stats = stats;
+    }
+  };
+
+  // ode() with the results written to a sink
+  template<class Sink, class Vector>
+  void ode_sink(Sink &res,
+		LSODA &lsoda,
+		Vector y,
+		Vector times,
+		LSODA_ODE_SYSTEM_TYPE func,
+		size_t nout = 0, // default value => y.size()
+		void* data = (void*) nullptr,
+		double rtol=1e-6, double atol = 1e-6) {
     size_t neq = y.size();
     if (nout == 0) nout = neq;
     if (nout < neq) Rcpp::stop("nout < neq");
-    LSODA lsoda;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
     double t = times[0], tout;
-    std::vector<double> yin(y.begin(), y.end()), yout(neq), ydot(nout);
+    std::vector<double> yin(y.begin(), y.end()), yout(neq), ydot(nout), dky(neq);
     int istate = 1;
-    size_t i, j;
-    Rcpp::NumericMatrix res(times.size(),nout+1);
-    res(0,0) = t;
-    for(j=0; j<neq; j++) res(0,j+1)=yin[j];
-    if (nout > neq) {
+    size_t i, j, k, nd = lsoda.derivatives();
+    /*
+      Selected columns: sel indexes the states and then the outputs of
+      func, and dsel the selected states, for the derivatives.  func is
+      only called for the outputs if one of them is selected.
+    */
+    std::vector<size_t> sel = lsoda.output_indices(), dsel;
+    if (sel.empty())
+      for(j=0; j<nout; j++) sel.push_back(j);
+    bool needres = false;
+    for(j=0; j<sel.size(); j++) {
+      if (sel[j] >= nout) Rcpp::stop("output index " + std::to_string(sel[j]+1) + " > nout");
+      if (sel[j] < neq) dsel.push_back(sel[j]);
+      else needres = true;
+    }
+    size_t nsel = sel.size(), ndsel = dsel.size();
+    res.init(times.size(),nsel+1+nd*ndsel);
+    res.set(0,0,t);
+    if (needres || nd > 0) {
       yin.resize(nout);
       (*func)(t, &yin[0], &ydot[0], data); // could this change data?
       yin.resize(neq);
-      for(j=neq; j<nout; j++)
-	res(0,j+1)=ydot[j];
     }
-    std::tuple<LSODA_ODE_SYSTEM_TYPE,size_t,size_t,void*> tuple{func,neq,nout,data};
+    for(j=0; j<nsel; j++) res.set(0,j+1, (sel[j] < neq) ? yin[sel[j]] : ydot[sel[j]]);
+    // at the initial time, dy/dt is from f and d2y/dt2 is not available
+    if (nd > 0) {
+      std::copy(ydot.begin(), ydot.begin()+neq, dky.begin());
+      lsoda.massdivide(dky);
+      for(j=0; j<ndsel; j++) res.set(0,nsel+1+j, dky[dsel[j]]);
+      for(k=2; k<=nd; k++)
+	for(j=0; j<ndsel; j++) res.set(0,nsel+1+(k-1)*ndsel+j, NA_REAL);
+    }
+    TruncTuple tuple = func_trunc_data(func, neq, nout, data);
     for(i = 1; i < times.size(); i++) {
         tout = times[i];
 	if (nout > neq) {
@@ -2231,22 +4220,92 @@ namespace LSODA {
 	  lsoda.lsoda_function(func, neq, yin, yout, &t, tout, &istate, data,
 			       rtol, atol);
         yin = yout;
-        res(i,0) = t;
-        for(j=0; j<neq; j++) res(i,j+1)=yout[j];
-	if (nout > neq) {
+        res.set(i,0,t);
+	if (needres) {
 	  yin.resize(nout);
 	  (*func)(t, &yin[0], &ydot[0], data); // could this change data?
 	  yin.resize(neq);
-	  for(j=neq; j<nout; j++) res(i,j+1)=ydot[j];
+	}
+	for(j=0; j<nsel; j++) res.set(i,j+1, (sel[j] < neq) ? yout[sel[j]] : ydot[sel[j]]);
+	for(k=1; k<=nd; k++) {
+	  lsoda.derivative(t, k, dky);
+	  for(j=0; j<ndsel; j++) res.set(i,nsel+1+(k-1)*ndsel+j, dky[dsel[j]]);
 	}
     }
-    Rcpp::CharacterVector nms(nout+1);
+    std::vector<std::string> nms(nsel+1+nd*ndsel);
     nms[0] = "time";
-    for (j=0; j<neq; j++) nms[j+1] = "y" + std::to_string(j+1);
-    if (nout > neq)
-      for(j=neq; j<nout; j++) nms[j+1] = "res" + std::to_string(j-neq+1);
-    colnames(res) = nms;
-    return res;
+    for (j=0; j<nsel; j++)
+      nms[j+1] = (sel[j] < neq) ? "y" + std::to_string(sel[j]+1) : "res" + std::to_string(sel[j]-neq+1);
+    for(k=1; k<=nd; k++)
+      for (j=0; j<ndsel; j++)
+	nms[nsel+1+(k-1)*ndsel+j] = (k == 1 ? "dy" : "d2y") + std::to_string(dsel[j]+1);
+    std::map<std::string, double> stats = lsoda.statistics();
+    if (metrics().enabled()) metrics_record(stats, lsoda.failure(), start);
+    res.finish(nms, stats);
+  }
+
+  // utility wrapper using a solver configured by the caller (e.g. set_mass())
+  template<class Vector>
+  Rcpp::NumericMatrix ode(LSODA &lsoda,
+			  Vector y,
+			  Vector times,
+			  LSODA_ODE_SYSTEM_TYPE func,
+			  size_t nout = 0, // default value => y.size()
+			  void* data = (void*) nullptr,
+			  double rtol=1e-6, double atol = 1e-6) {
+    MatrixSink res;
+    ode_sink(res, lsoda, y, times, func, nout, data, rtol, atol);
+    return res.res;
+  }
+
+  /*
+    Integrate from times[0] to the last time one step at a time ( itask =
+    2 ), keeping the steps in dense, for interpolation at any time within
+    the range afterwards.  After a failure, dense covers the steps before.
+  */
+  template<class Vector>
+  void ode_dense(DenseOutput &dense,
+		 LSODA &lsoda,
+		 Vector y,
+		 Vector times,
+		 LSODA_ODE_SYSTEM_TYPE func,
+		 size_t nout = 0, // default value => y.size()
+		 void* data = (void*) nullptr,
+		 double rtol=1e-6, double atol = 1e-6) {
+    size_t neq = y.size();
+    if (nout == 0) nout = neq;
+    if (nout < neq) Rcpp::stop("nout < neq");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double t0 = times[0], t = t0, tend = times[times.size()-1];
+    std::vector<double> yin(y.begin(), y.end()), yout(neq);
+    int istate = 1;
+    TruncTuple tuple = func_trunc_data(func, neq, nout, data);
+    dense.neq = neq;
+    while ((tend - t) * (tend - t0) > 0.) {
+      if (nout > neq)
+	lsoda.lsoda_function(func_trunc, neq, yin, yout, &t, tend, &istate,
+			     (void*) &tuple, rtol, atol, 2);
+      else
+	lsoda.lsoda_function(func, neq, yin, yout, &t, tend, &istate, data,
+			     rtol, atol, 2);
+      if (istate < 0)
+	break;
+      lsoda.dense_append(dense);
+      yin = yout;
+    }
+    if (metrics().enabled()) metrics_record(lsoda.statistics(), std::min(istate, 0), start);
+  }
+
+  // utility wrapper
+  template<class Vector>
+  Rcpp::NumericMatrix ode(Vector y,
+			  Vector times,
+			  LSODA_ODE_SYSTEM_TYPE func,
+			  size_t nout = 0, // default value => y.size()
+			  void* data = (void*) nullptr,
+			  double rtol=1e-6, double atol = 1e-6) {
+    LSODA lsoda;
+    return ode(lsoda, y, times, func, nout, data, rtol, atol);
   }
   // typedef void (*LSODA_ODE_SYSTEM_TYPE)(double t, double *y, double *dydt, void *);
   
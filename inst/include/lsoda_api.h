@@ -0,0 +1,254 @@
+/*
+ * Thin interface to the lsoda solver compiled into the lsoda package.
+ *
+ * This header declares no solver code: the functions are looked up with
+ * R_GetCCallable() from the package library, where src/api.cpp registers
+ * them.  Inline modules that include it, rather than lsoda.h, therefore
+ * compile in a fraction of the time.  Use it with
+ *
+ *   options(lsoda.inline = "api")
+ *   Rcpp::cppFunction(code, depends = "lsoda")
+ *
+ * or with LinkingTo: lsoda and Imports: lsoda in another package.  The
+ * ode() functions have the same signatures and results as those of
+ * lsoda.h; a Solver holds the settings that lsoda.h sets on an LSODA
+ * object.  Include either this header or lsoda.h, not both.
+ */
+
+#ifndef LSODA_API_H
+#define LSODA_API_H
+
+#ifdef LSODA_H
+#error "include either lsoda.h or lsoda_api.h"
+#endif
+
+#include <Rcpp.h>
+#include <R_ext/Rdynload.h>
+#include "lsoda_partition.h"
+#include "lsoda_metrics.h"
+
+namespace LSODA {
+
+  typedef void (*LSODA_ODE_SYSTEM_TYPE)(double t, double *y, double *dydt, void *);
+  typedef void (*LSODA_JAC_TYPE)(double t, double *y, double *pd, void *);
+
+  // heuristic constants of the step, as in lsoda.h
+  struct Heuristics {
+    double ccmax = 0.3;
+    size_t msbp = 20, maxcor = 3, mxncf = 10;
+    double ratio = 5.;
+  };
+
+  // an accepted step, as in lsoda.h
+  struct StepRecord {
+    double t, h;
+    int order, method;
+  };
+
+  /*
+    The C-callable functions, found once on first use.
+  */
+  namespace api {
+
+    typedef void* (*new_t)();
+    typedef void (*delete_t)(void*);
+    typedef const char* (*error_t)(void*);
+    typedef int (*set_jacobian_t)(void*, int, size_t, size_t);
+    typedef int (*set_size_t)(void*, size_t);
+    typedef int (*set_int_t)(void*, int);
+    typedef int (*set_threads_t)(void*, int, size_t);
+    typedef int (*set_heuristics_t)(void*, double, size_t, size_t, size_t, double);
+    typedef int (*set_jacfn_t)(void*, LSODA_JAC_TYPE, void*);
+    typedef int (*set_mass_t)(void*, const double*, size_t);
+    typedef int (*set_indices_t)(void*, const size_t*, size_t);
+    typedef int (*set_replay_t)(void*, const StepRecord*, size_t);
+    typedef const StepRecord* (*recorded_t)(void*, size_t*);
+    typedef int (*solve_t)(void*, LSODA_ODE_SYSTEM_TYPE, size_t, double*, double*,
+			   double, int*, void*, double, double);
+    typedef SEXP (*ode_t)(void*, LSODA_ODE_SYSTEM_TYPE, size_t, const double*,
+			  const double*, size_t, size_t, void*, double, double);
+    typedef void* (*metrics_t)();
+
+    template<class Fn>
+    inline Fn get(const char* name) {
+      return (Fn) R_GetCCallable("lsoda", name);
+    }
+
+  } // namespace api
+
+  /* --------------------------------------------------------------------------*/
+  /**
+   * @Synopsis  Handle on a solver in the package library, with the same
+   * settings and one-step interface as the LSODA class of lsoda.h.
+   */
+  /* ----------------------------------------------------------------------------*/
+  class Solver {
+  public:
+    Solver() {
+      static api::new_t fun = api::get<api::new_t>("lsoda_api_new");
+      handle = fun();
+    }
+    ~Solver() {
+      static api::delete_t fun = api::get<api::delete_t>("lsoda_api_delete");
+      fun(handle);
+    }
+    Solver(const Solver&) = delete;
+    Solver& operator=(const Solver&) = delete;
+
+    void set_jacobian(int jt, size_t ml = 0, size_t mu = 0) {
+      static api::set_jacobian_t fun = api::get<api::set_jacobian_t>("lsoda_api_set_jacobian");
+      check(fun(handle, jt, ml, mu));
+    }
+    void set_jacobian_function(LSODA_JAC_TYPE jac, void *data = nullptr) {
+      static api::set_jacfn_t fun = api::get<api::set_jacfn_t>("lsoda_api_set_jacobian_function");
+      check(fun(handle, jac, data));
+    }
+    void set_jacobian_blocks(size_t mb) {
+      static api::set_size_t fun = api::get<api::set_size_t>("lsoda_api_set_jacobian_blocks");
+      check(fun(handle, mb));
+    }
+    void set_mass(const std::vector<double> &mass) {
+      static api::set_mass_t fun = api::get<api::set_mass_t>("lsoda_api_set_mass");
+      check(fun(handle, mass.empty() ? nullptr : &mass[0], mass.size()));
+    }
+    void set_broyden(size_t maxupd) {
+      static api::set_size_t fun = api::get<api::set_size_t>("lsoda_api_set_broyden");
+      check(fun(handle, maxupd));
+    }
+    void set_heuristics(const Heuristics &heur) {
+      static api::set_heuristics_t fun = api::get<api::set_heuristics_t>("lsoda_api_set_heuristics");
+      check(fun(handle, heur.ccmax, heur.msbp, heur.maxcor, heur.mxncf, heur.ratio));
+    }
+    void set_threads(int threads, size_t threshold = 10000) {
+      static api::set_threads_t fun = api::get<api::set_threads_t>("lsoda_api_set_threads");
+      check(fun(handle, threads, threshold));
+    }
+    void set_anderson(size_t window) {
+      static api::set_size_t fun = api::get<api::set_size_t>("lsoda_api_set_anderson");
+      check(fun(handle, window));
+    }
+    void set_derivatives(size_t nd) {
+      static api::set_size_t fun = api::get<api::set_size_t>("lsoda_api_set_derivatives");
+      check(fun(handle, nd));
+    }
+    void set_norm(int norm) {
+      static api::set_int_t fun = api::get<api::set_int_t>("lsoda_api_set_norm");
+      check(fun(handle, norm));
+    }
+    void set_controller(int controller) {
+      static api::set_int_t fun = api::get<api::set_int_t>("lsoda_api_set_controller");
+      check(fun(handle, controller));
+    }
+    void set_initial_step(int method) {
+      static api::set_int_t fun = api::get<api::set_int_t>("lsoda_api_set_initial_step");
+      check(fun(handle, method));
+    }
+    void set_output_indices(const std::vector<size_t> &idx) {
+      static api::set_indices_t fun = api::get<api::set_indices_t>("lsoda_api_set_output_indices");
+      check(fun(handle, idx.empty() ? nullptr : &idx[0], idx.size()));
+    }
+    void set_record(bool record) {
+      static api::set_int_t fun = api::get<api::set_int_t>("lsoda_api_set_record");
+      check(fun(handle, record ? 1 : 0));
+    }
+    std::vector<StepRecord> recorded() {
+      static api::recorded_t fun = api::get<api::recorded_t>("lsoda_api_recorded");
+      size_t n = 0;
+      const StepRecord* steps = fun(handle, &n);
+      return std::vector<StepRecord>(steps, steps + n);
+    }
+    void set_replay(const std::vector<StepRecord> &steps) {
+      static api::set_replay_t fun = api::get<api::set_replay_t>("lsoda_api_set_replay");
+      check(fun(handle, steps.empty() ? nullptr : &steps[0], steps.size()));
+    }
+
+    /*
+      As LSODA::lsoda_function(): integrate from *t to tout, with y
+      (length neq) updated in place.
+    */
+    void lsoda_function(LSODA_ODE_SYSTEM_TYPE f, const size_t neq,
+			std::vector<double> &y, double *t, const double tout,
+			int *istate, void *_data, double rtol, double atol) {
+      static api::solve_t fun = api::get<api::solve_t>("lsoda_api_solve");
+      check(fun(handle, f, neq, &y[0], t, tout, istate, _data, rtol, atol));
+    }
+
+    Rcpp::NumericMatrix ode(LSODA_ODE_SYSTEM_TYPE func, const std::vector<double> &y,
+			    const std::vector<double> &times, size_t nout, void* data,
+			    double rtol, double atol) {
+      static api::ode_t fun = api::get<api::ode_t>("lsoda_api_ode");
+      SEXP res = fun(handle, func, y.size(), &y[0], &times[0], times.size(), nout,
+		     data, rtol, atol);
+      if (Rf_isNull(res)) check(-1);
+      return Rcpp::NumericMatrix(res);
+    }
+
+  private:
+    void check(int status) {
+      static api::error_t fun = api::get<api::error_t>("lsoda_api_error");
+      if (status != 0) Rcpp::stop(fun(handle));
+    }
+    void* handle;
+  };
+
+  // the metrics registry of the package library, which its solves go to
+  inline Metrics &metrics() {
+    static api::metrics_t fun = api::get<api::metrics_t>("lsoda_api_metrics");
+    return *static_cast<Metrics*>(fun());
+  }
+
+  // utility wrapper using a solver configured by the caller (e.g. set_mass())
+  template<class Vector>
+  Rcpp::NumericMatrix ode(Solver &solver,
+			  Vector y,
+			  Vector times,
+			  LSODA_ODE_SYSTEM_TYPE func,
+			  size_t nout = 0, // default value => y.size()
+			  void* data = (void*) nullptr,
+			  double rtol=1e-6, double atol = 1e-6) {
+    std::vector<double> yv(y.begin(), y.end());
+    std::vector<double> timesv(times.begin(), times.end());
+    return solver.ode(func, yv, timesv, nout, data, rtol, atol);
+  }
+
+  // utility wrapper
+  template<class Vector>
+  Rcpp::NumericMatrix ode(Vector y,
+			  Vector times,
+			  LSODA_ODE_SYSTEM_TYPE func,
+			  size_t nout = 0, // default value => y.size()
+			  void* data = (void*) nullptr,
+			  double rtol=1e-6, double atol = 1e-6) {
+    Solver solver;
+    return ode(solver, y, times, func, nout, data, rtol, atol);
+  }
+
+  // adaptor called by the functor ode()
+  template<class Functor, class Vector>
+  void lsoda_functor_adaptor(double t, double* y, double* ydot, void* data) {
+    using Tuple = std::tuple<Functor*, size_t, size_t>;
+    Tuple* tuple = static_cast<Tuple*>(data);
+    Functor* f = std::get<0>(*tuple);
+    size_t neq = std::get<1>(*tuple);
+    Vector yv(neq);
+    std::copy(y,y+neq,yv.begin());
+    Vector ydotv = (*f)(t,yv); // determines the functor signature
+    std::copy(ydotv.begin(),ydotv.end(),ydot);
+  }
+
+  template<class Functor, class Vector>
+  Rcpp::NumericMatrix ode(Vector y,
+			  Vector times,
+			  Functor functor,
+			  double rtol=1e-6, double atol = 1e-6) {
+    size_t nout = functor(times[0], y).size();
+    std::tuple<Functor*,size_t,size_t> tuple{&functor, y.size(), nout};
+    std::vector<double> yv(y.begin(), y.end());
+    std::vector<double> timesv(times.begin(), times.end());
+    return ode(yv, timesv, lsoda_functor_adaptor<Functor,Vector>, nout,
+	       (void*) &tuple, rtol, atol);
+  }
+
+} // namespace LSODA
+
+#endif /* end of include guard: LSODA_API_H */
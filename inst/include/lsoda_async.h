@@ -0,0 +1,264 @@
+/*
+ * Asynchronous solves on a shared, bounded pool of threads.
+ *
+ * A SolverPool runs ode() for submitted Problems on a fixed number of
+ * worker threads, highest priority first ( and in order of submission
+ * within a priority ).  submit() returns at once with a Job, a handle on
+ * the future Solution:
+ *
+ *   LSODA::Problem p;
+ *   p.y = {1, 0, 0}; p.times = {0, 0.4, 4, 40}; p.func = rober;
+ *   p.configure = [](LSODA::LSODA &s) { s.set_jacobian(2); };
+ *   LSODA::Job job = LSODA::SolverPool::shared().submit(p);
+ *   ...
+ *   LSODA::Solution sol = job.get(); // waits; rethrows a solver error
+ *   if(sol.istate < 0) ... // the solve failed, see sol.messages
+ *
+ * Each worker keeps one LSODA object, reset with set_defaults() and then
+ * configured by the Problem for each job, so that the work space is
+ * allocated once per worker rather than per solve.  Job::cancel() drops a
+ * job still queued, and stops one being solved at the next call of func;
+ * get() then throws LSODA::Cancelled.
+ *
+ * Thread-safety contract: func, configure and the Jacobian function run
+ * on a worker thread, so they must not call the R API ( no Rcpp types, R
+ * functions, Rprintf or R_CheckUserInterrupt ), and data must not be
+ * shared with other jobs without locking.  The diagnostics of the solver
+ * are kept in Solution::messages rather than printed, and a failed solve
+ * has its istate in Solution::istate.  Solver errors (
+ * Rcpp::stop, which only builds a C++ exception ) are passed to get().
+ * Only Solution and Job::get() are used from the caller, so R objects
+ * are made from the results on the R thread.
+ *
+ * Include this header after lsoda.h; the solver of lsoda_api.h returns R
+ * objects and cannot be used from the workers.
+ */
+
+#ifndef LSODA_ASYNC_H
+#define LSODA_ASYNC_H
+
+#include "lsoda.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+
+namespace LSODA {
+
+  // thrown by Job::get() for a cancelled job
+  struct Cancelled : public std::runtime_error {
+    Cancelled() : std::runtime_error("lsoda: solve cancelled") {}
+  };
+
+  /*
+    A problem for ode(): the initial values, the times ( including the
+    start time ), func with nout outputs ( 0 for neq ) and its data, the
+    tolerances, the settings of the solver ( a function called with the
+    solver, e.g. to set_jacobian() ), and the priority ( higher first ).
+  */
+  struct Problem {
+    std::vector<double> y, times;
+    LSODA_ODE_SYSTEM_TYPE func = nullptr;
+    size_t nout = 0;
+    void *data = nullptr;
+    double rtol = 1e-6, atol = 1e-6;
+    std::function<void(LSODA &)> configure;
+    int priority = 0;
+  };
+
+  class Job {
+  public:
+    Job() {}
+
+    // stop the solve: dropped if queued, stopped at the next call of func if running
+    void cancel() {
+      if(cancel_)
+	*cancel_ = true;
+    }
+
+    bool valid() const {
+      return result_.valid();
+    }
+
+    bool ready() const {
+      return result_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    void wait() const {
+      result_.wait();
+    }
+
+    // the results, waiting for them; rethrows the error of a failed job
+    Solution get() const {
+      return result_.get();
+    }
+
+  private:
+    friend class SolverPool;
+    std::shared_future<Solution> result_;
+    std::shared_ptr<std::atomic<bool> > cancel_;
+  };
+
+  namespace async {
+
+    struct Task {
+      Problem problem;
+      std::promise<Solution> result;
+      std::shared_ptr<std::atomic<bool> > cancel;
+    };
+
+    // queue order: priority, then submission
+    struct Entry {
+      int priority;
+      size_t seq;
+      std::shared_ptr<Task> task;
+      bool operator<(const Entry &e) const {
+	return priority < e.priority || (priority == e.priority && seq > e.seq);
+      }
+    };
+
+    // data for func_cancellable(): func, its data and the job's flag
+    struct CancelData {
+      LSODA_ODE_SYSTEM_TYPE func;
+      void *data;
+      const std::atomic<bool> *cancel;
+    };
+
+    // call func, unless the job was cancelled
+    inline
+    void func_cancellable(double t, double *y, double *ydot, void *data) {
+      const CancelData *cd = static_cast<const CancelData *>(data);
+      if(*cd->cancel)
+	throw Cancelled();
+      (*cd->func)(t, y, ydot, cd->data);
+    }
+
+  } // namespace async
+
+  class SolverPool {
+  public:
+    /*
+      threads workers ( 0 for the number of cores ), and at most capacity
+      jobs queued ( 0 for no limit ), beyond which submit() throws.
+    */
+    SolverPool(size_t threads = 0, size_t capacity = 0) : capacity_(capacity) {
+      if(threads == 0)
+	threads = std::max(std::thread::hardware_concurrency(), 1u);
+      for(size_t w = 0; w < threads; w++)
+	workers_.emplace_back(&SolverPool::work, this);
+    }
+
+    // cancels the queued jobs and waits for those running
+    ~SolverPool() {
+      {
+	std::lock_guard<std::mutex> lock(mutex_);
+	stop_ = true;
+	while(!queue_.empty()) {
+	  queue_.top().task->result.set_exception(std::make_exception_ptr(Cancelled()));
+	  queue_.pop();
+	}
+      }
+      ready_.notify_all();
+      for(size_t w = 0; w < workers_.size(); w++)
+	workers_[w].join();
+    }
+
+    SolverPool(const SolverPool &) = delete;
+    SolverPool &operator=(const SolverPool &) = delete;
+
+    // the pool shared by the process, with a worker per core
+    static SolverPool &shared() {
+      static SolverPool pool;
+      return pool;
+    }
+
+    Job submit(const Problem &problem) {
+      if(problem.func == nullptr)
+	throw std::invalid_argument("SolverPool::submit: no func");
+      if(problem.y.empty() || problem.times.empty())
+	throw std::invalid_argument("SolverPool::submit: y and times should not be empty");
+      std::shared_ptr<async::Task> task = std::make_shared<async::Task>();
+      task->problem = problem;
+      task->cancel  = std::make_shared<std::atomic<bool> >(false);
+      Job job;
+      job.result_ = task->result.get_future().share();
+      job.cancel_ = task->cancel;
+      {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if(capacity_ > 0 && queue_.size() >= capacity_)
+	  throw std::length_error("SolverPool::submit: queue full");
+	queue_.push(async::Entry{problem.priority, seq_++, task});
+      }
+      ready_.notify_one();
+      return job;
+    }
+
+    size_t threads() const {
+      return workers_.size();
+    }
+
+    // the jobs waiting for a worker
+    size_t queued() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return queue_.size();
+    }
+
+  private:
+    void work() {
+      LSODA solver; // this worker's work space, reused for each job
+      std::ostringstream diag;
+      capture() = &diag;
+      for(;;) {
+	std::shared_ptr<async::Task> task;
+	{
+	  std::unique_lock<std::mutex> lock(mutex_);
+	  ready_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+	  if(queue_.empty())
+	    break;
+	  task = queue_.top().task;
+	  queue_.pop();
+	}
+	run(*task, solver, diag);
+      }
+      capture() = nullptr;
+    }
+
+    static void run(async::Task &task, LSODA &solver, std::ostringstream &diag) {
+      if(*task.cancel) {
+	task.result.set_exception(std::make_exception_ptr(Cancelled()));
+	return;
+      }
+      const Problem &p = task.problem;
+      diag.str("");
+      try {
+	solver.set_defaults();
+	if(p.configure)
+	  p.configure(solver);
+	async::CancelData cd{p.func, p.data, task.cancel.get()};
+	VectorSink sink;
+	ode_sink(sink, solver, p.y, p.times, async::func_cancellable, p.nout,
+		 (void *) &cd, p.rtol, p.atol);
+	sink.res.istate   = solver.failure();
+	sink.res.messages = diag.str();
+	task.result.set_value(std::move(sink.res));
+      } catch(...) {
+	task.result.set_exception(std::current_exception());
+      }
+    }
+
+    size_t capacity_, seq_ = 0;
+    bool stop_ = false;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::priority_queue<async::Entry> queue_;
+    std::vector<std::thread> workers_;
+  };
+
+} // namespace LSODA
+
+#endif /* end of include guard: LSODA_ASYNC_H */
@@ -0,0 +1,250 @@
+/*
+ * Process-wide metrics of the solves, for tracking performance over time.
+ *
+ * When enabled, ode() ( through ode_sink() ) and ode_dense() add each
+ * solve to the registry returned by LSODA::metrics(): histograms of the
+ * steps, f evaluations, Jacobian evaluations and method switches per
+ * solve and of the wall time, and counts of the solves and of the
+ * failures by istate.  Every update is a relaxed atomic operation, so
+ * solves on any thread and any LSODA object are aggregated without locks:
+ *
+ *   LSODA::metrics().enable(true);
+ *   ...
+ *   LSODA::metrics().dump("lsoda_metrics.txt");
+ *
+ * The registry is one per shared library: a module compiled with lsoda.h
+ * has a registry of its own, while the solves of the package ( R's ode(),
+ * and modules on lsoda_api.h ) go to the package's, which metrics() of
+ * lsoda_api.h and ode_metrics() in R read.  Solves in forked processes (
+ * ode_ensemble() ) are not seen by the parent.
+ *
+ * This header is included by lsoda.h and lsoda_api.h.
+ */
+
+#ifndef LSODA_METRICS_H
+#define LSODA_METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace LSODA {
+
+  /*
+    Histogram of non-negative integers in buckets of powers of 2: bucket 0
+    holds 0 and bucket b >= 1 the values from 2^(b-1) to 2^b - 1.
+    Quantiles are the upper bound of their bucket ( capped by the
+    maximum ), so they are within a factor of 2.
+  */
+  class Histogram {
+  public:
+    static const size_t NBUCKETS = 65;
+
+    Histogram() {
+      reset();
+    }
+
+    void add(uint64_t x) {
+      buckets_[bucket(x)].fetch_add(1, std::memory_order_relaxed);
+      count_.fetch_add(1, std::memory_order_relaxed);
+      sum_.fetch_add(x, std::memory_order_relaxed);
+      uint64_t m = max_.load(std::memory_order_relaxed);
+      while(x > m && !max_.compare_exchange_weak(m, x, std::memory_order_relaxed))
+	;
+    }
+
+    void reset() {
+      for(size_t b = 0; b < NBUCKETS; b++)
+	buckets_[b].store(0, std::memory_order_relaxed);
+      count_.store(0, std::memory_order_relaxed);
+      sum_.store(0, std::memory_order_relaxed);
+      max_.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+      return count_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t sum() const {
+      return sum_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const {
+      return max_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t bucket_count(size_t b) const {
+      return buckets_[b].load(std::memory_order_relaxed);
+    }
+
+    double mean() const {
+      uint64_t n = count();
+      return n == 0 ? 0. : (double) sum() / (double) n;
+    }
+
+    // the value below which a fraction p of those added lie
+    double quantile(double p) const {
+      uint64_t n = count(), cum = 0;
+      if(n == 0)
+	return 0.;
+      for(size_t b = 0; b < NBUCKETS; b++) {
+	cum += bucket_count(b);
+	if((double) cum >= p * (double) n)
+	  return std::min(upper(b), (double) max());
+      }
+      return (double) max();
+    }
+
+    // the largest value in bucket b
+    static double upper(size_t b) {
+      return std::ldexp(1., (int) b) - 1.;
+    }
+
+    static size_t bucket(uint64_t x) {
+      size_t b = 0;
+      while(x > 0) {
+	x >>= 1;
+	b++;
+      }
+      return b;
+    }
+
+  private:
+    std::atomic<uint64_t> buckets_[NBUCKETS];
+    std::atomic<uint64_t> count_, sum_, max_;
+  };
+
+  /*
+    One row of Metrics::summary(): a histogram, or a count ( with the
+    other fields 0 ).
+  */
+  struct MetricSummary {
+    std::string name;
+    uint64_t count, sum, max;
+    double mean, p50, p90, p99;
+  };
+
+  class Metrics {
+  public:
+    // istate of the failures counted: -1 to -NFAIL
+    static const int NFAIL = 6;
+
+    Metrics() : enabled_(false) {
+      reset();
+    }
+
+    bool enabled() const {
+      return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // enable or disable recording; returns the previous setting
+    bool enable(bool on = true) {
+      return enabled_.exchange(on);
+    }
+
+    /*
+      Add a solve: the statistics of the solver, the first negative
+      istate ( or 0 for success ), and the wall time in seconds.
+    */
+    void record(size_t nst, size_t nfe, size_t nje, size_t nsw, int istate, double seconds) {
+      solves_.fetch_add(1, std::memory_order_relaxed);
+      steps_.add(nst);
+      rhs_.add(nfe);
+      jacobians_.add(nje);
+      switches_.add(nsw);
+      wall_.add((uint64_t) (seconds * 1e6 + 0.5));
+      if(istate < 0)
+	failures_[(-istate < NFAIL ? -istate : NFAIL) - 1].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void reset() {
+      solves_.store(0, std::memory_order_relaxed);
+      for(int k = 0; k < NFAIL; k++)
+	failures_[k].store(0, std::memory_order_relaxed);
+      steps_.reset();
+      rhs_.reset();
+      jacobians_.reset();
+      switches_.reset();
+      wall_.reset();
+    }
+
+    uint64_t solves() const {
+      return solves_.load(std::memory_order_relaxed);
+    }
+
+    // the failures with istate = -k, for k = 1 to NFAIL
+    uint64_t failures(int k) const {
+      return failures_[k - 1].load(std::memory_order_relaxed);
+    }
+
+    const Histogram &steps() const { return steps_; }
+    const Histogram &rhs() const { return rhs_; }
+    const Histogram &jacobians() const { return jacobians_; }
+    const Histogram &switches() const { return switches_; }
+    const Histogram &wall_us() const { return wall_; }
+
+    /*
+      The histograms ( per solve: nst, nfe, nje, nsw and the wall time in
+      microseconds ), then the counts of the solves and of the failures.
+    */
+    std::vector<MetricSummary> summary() const {
+      std::vector<MetricSummary> res;
+      const Histogram *h[] = {&steps_, &rhs_, &jacobians_, &switches_, &wall_};
+      const char *names[] = {"steps", "rhs_calls", "jacobians", "method_switches", "wall_us"};
+      for(size_t k = 0; k < 5; k++)
+	res.push_back(MetricSummary{names[k], h[k]->count(), h[k]->sum(), h[k]->max(), h[k]->mean(),
+				    h[k]->quantile(0.5), h[k]->quantile(0.9), h[k]->quantile(0.99)});
+      res.push_back(MetricSummary{"solves", solves(), 0, 0, 0., 0., 0., 0.});
+      for(int k = 1; k <= NFAIL; k++)
+	res.push_back(MetricSummary{"failures_istate_" + std::to_string(-k), failures(k),
+				    0, 0, 0., 0., 0., 0.});
+      return res;
+    }
+
+    // the summary and the non-empty buckets, as text
+    std::string text() const {
+      std::ostringstream out;
+      std::time_t now = std::time(nullptr);
+      char stamp[32];
+      std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
+      out << "# lsoda metrics at " << stamp << "\n";
+      out << "metric count sum mean p50 p90 p99 max\n";
+      std::vector<MetricSummary> s = summary();
+      for(size_t k = 0; k < s.size(); k++)
+	out << s[k].name << " " << s[k].count << " " << s[k].sum << " " << s[k].mean << " "
+	    << s[k].p50 << " " << s[k].p90 << " " << s[k].p99 << " " << s[k].max << "\n";
+      out << "# buckets: metric, bucket upper bound, count\n";
+      const Histogram *h[] = {&steps_, &rhs_, &jacobians_, &switches_, &wall_};
+      for(size_t k = 0; k < 5; k++)
+	for(size_t b = 0; b < Histogram::NBUCKETS; b++)
+	  if(h[k]->bucket_count(b) > 0)
+	    out << s[k].name << " " << Histogram::upper(b) << " " << h[k]->bucket_count(b) << "\n";
+      return out.str();
+    }
+
+    // append text() to a file; false if it cannot be written
+    bool dump(const std::string &file) const {
+      std::ofstream out(file.c_str(), std::ios::app);
+      if(!out)
+	return false;
+      out << text() << "\n";
+      return (bool) out;
+    }
+
+  private:
+    std::atomic<bool> enabled_;
+    std::atomic<uint64_t> solves_;
+    std::atomic<uint64_t> failures_[NFAIL];
+    Histogram steps_, rhs_, jacobians_, switches_, wall_;
+  };
+
+} // namespace LSODA
+
+#endif /* end of include guard: LSODA_METRICS_H */
@@ -0,0 +1,29 @@
+/*
+ * Native model interface of the lsoda package.
+ *
+ * ode_model() generates and compiles the right-hand side (and optionally
+ * the Jacobian) of an ODE model, and hands the solver a pointer to a
+ * Model with these functions.  The parameters are passed as the data
+ * pointer, a double array of length nparms.  This header only has the
+ * types, and is included by the generated code and by src/unit.cpp.
+ */
+
+#ifndef LSODA_MODEL_H
+#define LSODA_MODEL_H
+
+#include <cstddef>
+
+namespace LSODA {
+
+  typedef void (*LSODA_ODE_SYSTEM_TYPE)(double t, double *y, double *dydt, void *);
+  typedef void (*LSODA_JAC_TYPE)(double t, double *y, double *pd, void *);
+
+  struct Model {
+    LSODA_ODE_SYSTEM_TYPE rhs; // sets dydt[0..neq-1], then outputs up to nout-1
+    LSODA_JAC_TYPE jac;        // pd[i + neq * j] = df_i / dy_j, or nullptr
+    size_t neq, nout, nparms;
+  };
+
+} // namespace LSODA
+
+#endif /* end of include guard: LSODA_MODEL_H */
@@ -0,0 +1,111 @@
+/*
+ * Partitioned right-hand sides for large systems.
+ *
+ * Many large systems ( e.g. spatial discretisations ) compute dy/dt in
+ * independent blocks of states.  A Partition holds a range function, which
+ * sets dydt[first..last-1] from t and the whole of y, and the bounds of
+ * the blocks; func_partitioned() is an ordinary LSODA_ODE_SYSTEM_TYPE
+ * that evaluates the blocks concurrently on OpenMP threads, so that every
+ * call of f by the solver ( the start, the corrector and the finite
+ * difference Jacobian ) is parallel:
+ *
+ *   LSODA::Partition part(range_fn, neq, 64, data);
+ *   LSODA::ode(solver, y, times, LSODA::func_partitioned, neq, &part);
+ *
+ * Thread-safety contract for the range function:
+ * - it may read all of y and data, but write only dydt[first..last-1];
+ * - it must not modify data or shared state without its own locking;
+ * - it must not call the R API ( no Rcpp types, R functions, Rprintf or
+ *   Rcpp::stop ): only the calling thread may do that.  A C++ exception
+ *   thrown from a block is passed on to the caller after all blocks end.
+ * Without OpenMP the blocks are evaluated in turn.  Extra outputs
+ * ( nout > neq ) are not computed: pass nout = neq.
+ *
+ * This header is included by lsoda.h and lsoda_api.h.
+ */
+
+#ifndef LSODA_PARTITION_H
+#define LSODA_PARTITION_H
+
+#include <cstddef>
+#include <exception>
+#include <stdexcept>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace LSODA {
+
+  typedef void (*LSODA_ODE_SYSTEM_TYPE)(double t, double *y, double *dydt, void *);
+
+  /*
+    Type of a range function: sets dydt[first..last-1] ( 0-based ).
+  */
+  typedef void (*LSODA_RANGE_TYPE)(double t, const double *y, double *dydt,
+				   size_t first, size_t last, void *);
+
+  struct Partition {
+    LSODA_RANGE_TYPE func;
+    void *data;
+    std::vector<size_t> bounds; // block b is bounds[b] to bounds[b+1] - 1
+    int threads;                // 0 for the OpenMP default
+
+    /*
+      nblocks blocks of ( nearly ) equal size.
+    */
+    Partition(LSODA_RANGE_TYPE func, size_t neq, size_t nblocks,
+	      void *data = nullptr, int threads = 0)
+      : func(func), data(data), threads(threads) {
+      if(nblocks < 1 || nblocks > neq)
+	throw std::invalid_argument("Partition: nblocks should be between 1 and neq");
+      for(size_t b = 0; b <= nblocks; b++)
+	bounds.push_back(neq * b / nblocks);
+    }
+
+    /*
+      Blocks given by their bounds: 0 = bounds[0] < ... < bounds.back() = neq.
+    */
+    Partition(LSODA_RANGE_TYPE func, size_t neq, const std::vector<size_t> &bounds,
+	      void *data = nullptr, int threads = 0)
+      : func(func), data(data), bounds(bounds), threads(threads) {
+      if(bounds.size() < 2 || bounds[0] != 0)
+	throw std::invalid_argument("Partition: bounds should start at 0");
+      for(size_t b = 1; b < bounds.size(); b++)
+	if(bounds[b] <= bounds[b-1])
+	  throw std::invalid_argument("Partition: bounds should be increasing");
+      if(bounds.back() != neq)
+	throw std::invalid_argument("Partition: bounds should end at neq");
+    }
+
+    size_t blocks() const {
+      return bounds.size() - 1;
+    }
+  };
+
+  // f for a Partition passed as the data
+  inline
+  void func_partitioned(double t, double* y, double* ydot, void* data) {
+    const Partition* part = static_cast<const Partition*>(data);
+    const long nb = (long) part->blocks();
+    std::exception_ptr error = nullptr;
+#ifdef _OPENMP
+    int threads = (part->threads > 0) ? part->threads : omp_get_max_threads();
+#pragma omp parallel for schedule(static) num_threads(threads) if(nb > 1 && threads > 1)
+#endif
+    for(long b = 0; b < nb; b++) {
+      try {
+	(*part->func)(t, y, ydot, part->bounds[b], part->bounds[b+1], part->data);
+      } catch(...) {
+#ifdef _OPENMP
+#pragma omp critical(lsoda_partition)
+#endif
+	if(!error) error = std::current_exception();
+      }
+    }
+    if(error) std::rethrow_exception(error);
+  }
+
+} // namespace LSODA
+
+#endif /* end of include guard: LSODA_PARTITION_H */
@@ -11,9 +11,57 @@ Rcpp::Rostream<true>&  Rcpp::Rcout = Rcpp::Rcpp_cout_get();
 Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
+// ode_ensemble_cpp
+Rcpp::NumericVector ode_ensemble_cpp(Rcpp::NumericMatrix y0, std::vector<double> times, Rcpp::Function closure, double rtol, double atol, int workers);
+RcppExport SEXP _lsoda_ode_ensemble_cpp(SEXP y0SEXP, SEXP timesSEXP, SEXP closureSEXP, SEXP rtolSEXP, SEXP atolSEXP, SEXP workersSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::NumericMatrix >::type y0(y0SEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type times(timesSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Function >::type closure(closureSEXP);
+    Rcpp::traits::input_parameter< double >::type rtol(rtolSEXP);
+    Rcpp::traits::input_parameter< double >::type atol(atolSEXP);
+    Rcpp::traits::input_parameter< int >::type workers(workersSEXP);
+    rcpp_result_gen = Rcpp::wrap(ode_ensemble_cpp(y0, times, closure, rtol, atol, workers));
+    return rcpp_result_gen;
+END_RCPP
+}
+// ode_metrics
+Rcpp::DataFrame ode_metrics(bool reset);
+RcppExport SEXP _lsoda_ode_metrics(SEXP resetSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< bool >::type reset(resetSEXP);
+    rcpp_result_gen = Rcpp::wrap(ode_metrics(reset));
+    return rcpp_result_gen;
+END_RCPP
+}
+// ode_metrics_enable
+bool ode_metrics_enable(bool enable);
+RcppExport SEXP _lsoda_ode_metrics_enable(SEXP enableSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< bool >::type enable(enableSEXP);
+    rcpp_result_gen = Rcpp::wrap(ode_metrics_enable(enable));
+    return rcpp_result_gen;
+END_RCPP
+}
+// ode_metrics_dump
+void ode_metrics_dump(std::string file);
+RcppExport SEXP _lsoda_ode_metrics_dump(SEXP fileSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type file(fileSEXP);
+    ode_metrics_dump(file);
+    return R_NilValue;
+END_RCPP
+}
 // ode_cpp
-Rcpp::NumericMatrix ode_cpp(std::vector<double> y, std::vector<double> times, Rcpp::Function func, double rtol, double atol);
-RcppExport SEXP _lsoda_ode_cpp(SEXP ySEXP, SEXP timesSEXP, SEXP funcSEXP, SEXP rtolSEXP, SEXP atolSEXP) {
+SEXP ode_cpp(std::vector<double> y, std::vector<double> times, Rcpp::Function func, double rtol, double atol, Rcpp::Nullable<Rcpp::NumericVector> mass, std::string jacobian, Rcpp::Nullable<Rcpp::IntegerVector> bandwidth, int blocksize, int broyden, int derivatives, Rcpp::Nullable<Rcpp::IntegerVector> select, std::string storage, int trace, std::string norm, std::string controller, std::string initial_step, int anderson, SEXP heuristics, SEXP steps);
+RcppExport SEXP _lsoda_ode_cpp(SEXP ySEXP, SEXP timesSEXP, SEXP funcSEXP, SEXP rtolSEXP, SEXP atolSEXP, SEXP massSEXP, SEXP jacobianSEXP, SEXP bandwidthSEXP, SEXP blocksizeSEXP, SEXP broydenSEXP, SEXP derivativesSEXP, SEXP selectSEXP, SEXP storageSEXP, SEXP traceSEXP, SEXP normSEXP, SEXP controllerSEXP, SEXP initial_stepSEXP, SEXP andersonSEXP, SEXP heuristicsSEXP, SEXP stepsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -22,17 +70,112 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< Rcpp::Function >::type func(funcSEXP);
     Rcpp::traits::input_parameter< double >::type rtol(rtolSEXP);
     Rcpp::traits::input_parameter< double >::type atol(atolSEXP);
-    rcpp_result_gen = Rcpp::wrap(ode_cpp(y, times, func, rtol, atol));
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::NumericVector> >::type mass(massSEXP);
+    Rcpp::traits::input_parameter< std::string >::type jacobian(jacobianSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::IntegerVector> >::type bandwidth(bandwidthSEXP);
+    Rcpp::traits::input_parameter< int >::type blocksize(blocksizeSEXP);
+    Rcpp::traits::input_parameter< int >::type broyden(broydenSEXP);
+    Rcpp::traits::input_parameter< int >::type derivatives(derivativesSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::IntegerVector> >::type select(selectSEXP);
+    Rcpp::traits::input_parameter< std::string >::type storage(storageSEXP);
+    Rcpp::traits::input_parameter< int >::type trace(traceSEXP);
+    Rcpp::traits::input_parameter< std::string >::type norm(normSEXP);
+    Rcpp::traits::input_parameter< std::string >::type controller(controllerSEXP);
+    Rcpp::traits::input_parameter< std::string >::type initial_step(initial_stepSEXP);
+    Rcpp::traits::input_parameter< int >::type anderson(andersonSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type heuristics(heuristicsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type steps(stepsSEXP);
+    rcpp_result_gen = Rcpp::wrap(ode_cpp(y, times, func, rtol, atol, mass, jacobian, bandwidth, blocksize, broyden, derivatives, select, storage, trace, norm, controller, initial_step, anderson, heuristics, steps));
+    return rcpp_result_gen;
+END_RCPP
+}
+// ode_model_cpp
+SEXP ode_model_cpp(std::vector<double> y, std::vector<double> times, SEXP model, std::vector<double> parms, double rtol, double atol, Rcpp::Nullable<Rcpp::NumericVector> mass, std::string jacobian, Rcpp::Nullable<Rcpp::IntegerVector> bandwidth, int blocksize, int broyden, int derivatives, Rcpp::Nullable<Rcpp::IntegerVector> select, std::string storage, int trace, std::string norm, std::string controller, std::string initial_step, int anderson, SEXP heuristics, SEXP steps);
+RcppExport SEXP _lsoda_ode_model_cpp(SEXP ySEXP, SEXP timesSEXP, SEXP modelSEXP, SEXP parmsSEXP, SEXP rtolSEXP, SEXP atolSEXP, SEXP massSEXP, SEXP jacobianSEXP, SEXP bandwidthSEXP, SEXP blocksizeSEXP, SEXP broydenSEXP, SEXP derivativesSEXP, SEXP selectSEXP, SEXP storageSEXP, SEXP traceSEXP, SEXP normSEXP, SEXP controllerSEXP, SEXP initial_stepSEXP, SEXP andersonSEXP, SEXP heuristicsSEXP, SEXP stepsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::vector<double> >::type y(ySEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type times(timesSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type model(modelSEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type parms(parmsSEXP);
+    Rcpp::traits::input_parameter< double >::type rtol(rtolSEXP);
+    Rcpp::traits::input_parameter< double >::type atol(atolSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::NumericVector> >::type mass(massSEXP);
+    Rcpp::traits::input_parameter< std::string >::type jacobian(jacobianSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::IntegerVector> >::type bandwidth(bandwidthSEXP);
+    Rcpp::traits::input_parameter< int >::type blocksize(blocksizeSEXP);
+    Rcpp::traits::input_parameter< int >::type broyden(broydenSEXP);
+    Rcpp::traits::input_parameter< int >::type derivatives(derivativesSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::IntegerVector> >::type select(selectSEXP);
+    Rcpp::traits::input_parameter< std::string >::type storage(storageSEXP);
+    Rcpp::traits::input_parameter< int >::type trace(traceSEXP);
+    Rcpp::traits::input_parameter< std::string >::type norm(normSEXP);
+    Rcpp::traits::input_parameter< std::string >::type controller(controllerSEXP);
+    Rcpp::traits::input_parameter< std::string >::type initial_step(initial_stepSEXP);
+    Rcpp::traits::input_parameter< int >::type anderson(andersonSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type heuristics(heuristicsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type steps(stepsSEXP);
+    rcpp_result_gen = Rcpp::wrap(ode_model_cpp(y, times, model, parms, rtol, atol, mass, jacobian, bandwidth, blocksize, broyden, derivatives, select, storage, trace, norm, controller, initial_step, anderson, heuristics, steps));
+    return rcpp_result_gen;
+END_RCPP
+}
+// lsoda_float_expand
+Rcpp::NumericMatrix lsoda_float_expand(Rcpp::RawVector x, Rcpp::IntegerVector i, Rcpp::IntegerVector j);
+RcppExport SEXP _lsoda_lsoda_float_expand(SEXP xSEXP, SEXP iSEXP, SEXP jSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::RawVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type i(iSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type j(jSEXP);
+    rcpp_result_gen = Rcpp::wrap(lsoda_float_expand(x, i, j));
     return rcpp_result_gen;
 END_RCPP
 }
+// ode_tuner
+SEXP ode_tuner(double jacweight, int batch);
+RcppExport SEXP _lsoda_ode_tuner(SEXP jacweightSEXP, SEXP batchSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< double >::type jacweight(jacweightSEXP);
+    Rcpp::traits::input_parameter< int >::type batch(batchSEXP);
+    rcpp_result_gen = Rcpp::wrap(ode_tuner(jacweight, batch));
+    return rcpp_result_gen;
+END_RCPP
+}
+// tuner_state
+Rcpp::List tuner_state(SEXP tuner);
+RcppExport SEXP _lsoda_tuner_state(SEXP tunerSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type tuner(tunerSEXP);
+    rcpp_result_gen = Rcpp::wrap(tuner_state(tuner));
+    return rcpp_result_gen;
+END_RCPP
+}
+
+void lsoda_init_altrep(DllInfo* dll);
+void lsoda_init_api(DllInfo* dll);
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_lsoda_ode_cpp", (DL_FUNC) &_lsoda_ode_cpp, 5},
+    {"_lsoda_ode_ensemble_cpp", (DL_FUNC) &_lsoda_ode_ensemble_cpp, 6},
+    {"_lsoda_ode_metrics", (DL_FUNC) &_lsoda_ode_metrics, 1},
+    {"_lsoda_ode_metrics_enable", (DL_FUNC) &_lsoda_ode_metrics_enable, 1},
+    {"_lsoda_ode_metrics_dump", (DL_FUNC) &_lsoda_ode_metrics_dump, 1},
+    {"_lsoda_ode_cpp", (DL_FUNC) &_lsoda_ode_cpp, 20},
+    {"_lsoda_ode_model_cpp", (DL_FUNC) &_lsoda_ode_model_cpp, 21},
+    {"_lsoda_lsoda_float_expand", (DL_FUNC) &_lsoda_lsoda_float_expand, 3},
+    {"_lsoda_ode_tuner", (DL_FUNC) &_lsoda_ode_tuner, 2},
+    {"_lsoda_tuner_state", (DL_FUNC) &_lsoda_tuner_state, 1},
     {NULL, NULL, 0}
 };
 
 RcppExport void R_init_lsoda(DllInfo *dll) {
     R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
+    lsoda_init_altrep(dll);
+    lsoda_init_api(dll);
 }
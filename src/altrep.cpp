@@ -0,0 +1,160 @@
+#include "lsoda.h"
+#include <R_ext/Altrep.h>
+
+/*
+  Lazy results for storage = "lazy": a numeric matrix, as an ALTREP
+  vector, of the times and states that keeps only the Nordsieck arrays
+  of the steps taken (LSODA::DenseOutput) and interpolates an element
+  when it is read.  R code that needs the whole matrix at once (e.g.
+  arithmetic on it) materialises it on first use through Dataptr, after
+  which it is an ordinary matrix.
+*/
+
+namespace LSODA {
+
+  struct LazyMatrix {
+    DenseOutput dense;
+    std::vector<double> times, y0;
+    std::vector<size_t> step; // step covering each time, dense.size() if none
+    size_t nrow, ncol;
+
+    double elt(R_xlen_t i) const {
+      size_t row = i % nrow, col = i / nrow;
+      if (col == 0) return times[row];
+      if (row == 0) return y0[col-1];
+      if (step[row] >= dense.size()) return NA_REAL;
+      return dense.value(step[row], times[row], col-1);
+    }
+  };
+
+  static R_altrep_class_t lazy_class;
+
+  static LazyMatrix* lazy_get(SEXP x) {
+    return static_cast<LazyMatrix*>(R_ExternalPtrAddr(R_altrep_data1(x)));
+  }
+
+  static void lazy_finalize(SEXP ptr) {
+    delete static_cast<LazyMatrix*>(R_ExternalPtrAddr(ptr));
+    R_ClearExternalPtr(ptr);
+  }
+
+  static R_xlen_t lazy_length(SEXP x) {
+    SEXP data2 = R_altrep_data2(x);
+    if (data2 != R_NilValue) return XLENGTH(data2);
+    LazyMatrix* m = lazy_get(x);
+    return (R_xlen_t) m->nrow * m->ncol;
+  }
+
+  static double lazy_elt(SEXP x, R_xlen_t i) {
+    SEXP data2 = R_altrep_data2(x);
+    if (data2 != R_NilValue) return REAL(data2)[i];
+    return lazy_get(x)->elt(i);
+  }
+
+  static R_xlen_t lazy_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double* buf) {
+    SEXP data2 = R_altrep_data2(x);
+    R_xlen_t len = lazy_length(x), k;
+    if (n > len - i) n = len - i;
+    if (data2 != R_NilValue) {
+      std::copy(REAL(data2) + i, REAL(data2) + i + n, buf);
+      return n;
+    }
+    LazyMatrix* m = lazy_get(x);
+    for (k = 0; k < n; k++) buf[k] = m->elt(i + k);
+    return n;
+  }
+
+  // the whole matrix, kept in data2 from the first call
+  static void* lazy_dataptr(SEXP x, Rboolean writeable) {
+    (void) writeable;
+    SEXP data2 = R_altrep_data2(x);
+    if (data2 == R_NilValue) {
+      R_xlen_t len = lazy_length(x);
+      data2 = PROTECT(Rf_allocVector(REALSXP, len));
+      lazy_get_region(x, 0, len, REAL(data2));
+      R_set_altrep_data2(x, data2);
+      UNPROTECT(1);
+    }
+    return REAL(data2);
+  }
+
+  static const void* lazy_dataptr_or_null(SEXP x) {
+    SEXP data2 = R_altrep_data2(x);
+    return (data2 == R_NilValue) ? nullptr : REAL(data2);
+  }
+
+  static Rboolean lazy_inspect(SEXP x, int pre, int deep, int pvec,
+			       void (*inspect_subtree)(SEXP, int, int, int)) {
+    (void) pre; (void) deep; (void) pvec; (void) inspect_subtree;
+    LazyMatrix* m = lazy_get(x);
+    Rprintf(" lsoda_lazy %d x %d, %d steps%s\n", (int) m->nrow, (int) m->ncol,
+	    (int) m->dense.size(),
+	    (R_altrep_data2(x) == R_NilValue) ? "" : ", materialised");
+    return TRUE;
+  }
+
+  // saved as an ordinary vector: the steps are not worth keeping
+  static SEXP lazy_serialized_state(SEXP x) {
+    R_xlen_t len = lazy_length(x);
+    SEXP state = PROTECT(Rf_allocVector(REALSXP, len));
+    lazy_get_region(x, 0, len, REAL(state));
+    UNPROTECT(1);
+    return state;
+  }
+
+  static SEXP lazy_unserialize(SEXP cls, SEXP state) {
+    (void) cls;
+    return state;
+  }
+
+  // integrate with dense output, and return the lazy matrix
+  SEXP ode_lazy(LSODA &solver, std::vector<double> y, std::vector<double> times,
+		LSODA_ODE_SYSTEM_TYPE func, size_t nout, void* data,
+		double rtol, double atol) {
+    if (solver.derivatives() > 0)
+      Rcpp::stop("derivatives are not available with storage = \"lazy\"");
+    if (!solver.output_indices().empty())
+      Rcpp::stop("select is not available with storage = \"lazy\"");
+    LazyMatrix* m = new LazyMatrix();
+    SEXP ptr = PROTECT(R_MakeExternalPtr(m, R_NilValue, R_NilValue));
+    R_RegisterCFinalizerEx(ptr, lazy_finalize, TRUE);
+    ode_dense(m->dense, solver, y, times, func, nout, data, rtol, atol);
+    // the steps stop at the failure: the later rows read as NA
+    if (solver.failure() < 0)
+      Rcpp::warning("ode: lsoda failed with istate = " + std::to_string(solver.failure()) +
+		    "; the values past the last step taken are NA");
+    m->times = times;
+    m->y0 = y;
+    m->nrow = times.size();
+    m->ncol = 1 + y.size();
+    m->step.resize(m->nrow);
+    for (size_t i = 0; i < m->nrow; i++)
+      m->step[i] = m->dense.locate(times[i]);
+    SEXP res = PROTECT(R_new_altrep(lazy_class, ptr, R_NilValue));
+    Rcpp::IntegerVector dims = Rcpp::IntegerVector::create((int) m->nrow, (int) m->ncol);
+    Rcpp::CharacterVector nms(m->ncol);
+    nms[0] = "time";
+    for (size_t j = 1; j < m->ncol; j++)
+      nms[j] = "y" + std::to_string(j);
+    Rf_setAttrib(res, R_DimSymbol, dims);
+    Rf_setAttrib(res, R_DimNamesSymbol, Rcpp::List::create(R_NilValue, nms));
+    Rf_setAttrib(res, Rf_install("stats"), Rcpp::wrap(solver.statistics()));
+    UNPROTECT(2);
+    return res;
+  }
+
+} // namespace LSODA
+
+// [[Rcpp::init]]
+void lsoda_init_altrep(DllInfo* dll) {
+  using namespace LSODA;
+  lazy_class = R_make_altreal_class("lsoda_lazy", "lsoda", dll);
+  R_set_altrep_Length_method(lazy_class, lazy_length);
+  R_set_altrep_Inspect_method(lazy_class, lazy_inspect);
+  R_set_altrep_Serialized_state_method(lazy_class, lazy_serialized_state);
+  R_set_altrep_Unserialize_method(lazy_class, lazy_unserialize);
+  R_set_altvec_Dataptr_method(lazy_class, lazy_dataptr);
+  R_set_altvec_Dataptr_or_null_method(lazy_class, lazy_dataptr_or_null);
+  R_set_altreal_Elt_method(lazy_class, lazy_elt);
+  R_set_altreal_Get_region_method(lazy_class, lazy_get_region);
+}
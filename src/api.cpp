@@ -0,0 +1,238 @@
+#include "lsoda.h"
+#include <R_ext/Rdynload.h>
+
+/*
+  C-callable interface to the solver compiled into the package library.
+  Inline modules include the thin header lsoda_api.h instead of lsoda.h,
+  and reach these functions through R_GetCCallable("lsoda", ...), so that
+  the solver itself is compiled only once, here.
+
+  Exceptions do not cross this interface: each function returns 0 on
+  success (or a result), and otherwise keeps the message for
+  lsoda_api_error() and returns -1 (or R_NilValue).
+*/
+
+namespace LSODA {
+
+  struct ApiHandle {
+    LSODA solver;
+    std::string error;
+  };
+
+} // namespace LSODA
+
+extern "C" {
+
+  void* lsoda_api_new() {
+    return (void*) new LSODA::ApiHandle();
+  }
+
+  void lsoda_api_delete(void* handle) {
+    delete static_cast<LSODA::ApiHandle*>(handle);
+  }
+
+  const char* lsoda_api_error(void* handle) {
+    return static_cast<LSODA::ApiHandle*>(handle)->error.c_str();
+  }
+
+  int lsoda_api_set_jacobian(void* handle, int jt, size_t ml, size_t mu) {
+    static_cast<LSODA::ApiHandle*>(handle)->solver.set_jacobian(jt, ml, mu);
+    return 0;
+  }
+
+  int lsoda_api_set_jacobian_blocks(void* handle, size_t mb) {
+    static_cast<LSODA::ApiHandle*>(handle)->solver.set_jacobian_blocks(mb);
+    return 0;
+  }
+
+  int lsoda_api_set_jacobian_function(void* handle, LSODA::LSODA_JAC_TYPE jac, void* data) {
+    static_cast<LSODA::ApiHandle*>(handle)->solver.set_jacobian_function(jac, data);
+    return 0;
+  }
+
+  int lsoda_api_set_mass(void* handle, const double* mass, size_t neq) {
+    static_cast<LSODA::ApiHandle*>(handle)->solver.set_mass(std::vector<double>(mass, mass+neq));
+    return 0;
+  }
+
+  int lsoda_api_set_broyden(void* handle, size_t maxupd) {
+    static_cast<LSODA::ApiHandle*>(handle)->solver.set_broyden(maxupd);
+    return 0;
+  }
+
+  int lsoda_api_set_heuristics(void* handle, double ccmax, size_t msbp, size_t maxcor,
+			       size_t mxncf, double ratio) {
+    LSODA::ApiHandle* h = static_cast<LSODA::ApiHandle*>(handle);
+    try {
+      LSODA::Heuristics heur;
+      heur.ccmax  = ccmax;
+      heur.msbp   = msbp;
+      heur.maxcor = maxcor;
+      heur.mxncf  = mxncf;
+      heur.ratio  = ratio;
+      h->solver.set_heuristics(heur);
+    } catch (std::exception &e) {
+      h->error = e.what();
+      return -1;
+    }
+    return 0;
+  }
+
+  int lsoda_api_set_threads(void* handle, int threads, size_t threshold) {
+    LSODA::ApiHandle* h = static_cast<LSODA::ApiHandle*>(handle);
+    try {
+      h->solver.set_threads(threads, threshold);
+    } catch (std::exception &e) {
+      h->error = e.what();
+      return -1;
+    }
+    return 0;
+  }
+
+  int lsoda_api_set_anderson(void* handle, size_t window) {
+    LSODA::ApiHandle* h = static_cast<LSODA::ApiHandle*>(handle);
+    try {
+      h->solver.set_anderson(window);
+    } catch (std::exception &e) {
+      h->error = e.what();
+      return -1;
+    }
+    return 0;
+  }
+
+  int lsoda_api_set_derivatives(void* handle, size_t nd) {
+    LSODA::ApiHandle* h = static_cast<LSODA::ApiHandle*>(handle);
+    try {
+      h->solver.set_derivatives(nd);
+    } catch (std::exception &e) {
+      h->error = e.what();
+      return -1;
+    }
+    return 0;
+  }
+
+  int lsoda_api_set_norm(void* handle, int norm) {
+    LSODA::ApiHandle* h = static_cast<LSODA::ApiHandle*>(handle);
+    try {
+      h->solver.set_norm(norm);
+    } catch (std::exception &e) {
+      h->error = e.what();
+      return -1;
+    }
+    return 0;
+  }
+
+  int lsoda_api_set_controller(void* handle, int controller) {
+    LSODA::ApiHandle* h = static_cast<LSODA::ApiHandle*>(handle);
+    try {
+      h->solver.set_controller(controller);
+    } catch (std::exception &e) {
+      h->error = e.what();
+      return -1;
+    }
+    return 0;
+  }
+
+  int lsoda_api_set_initial_step(void* handle, int method) {
+    LSODA::ApiHandle* h = static_cast<LSODA::ApiHandle*>(handle);
+    try {
+      h->solver.set_initial_step(method);
+    } catch (std::exception &e) {
+      h->error = e.what();
+      return -1;
+    }
+    return 0;
+  }
+
+  int lsoda_api_set_record(void* handle, int record) {
+    static_cast<LSODA::ApiHandle*>(handle)->solver.set_record(record != 0);
+    return 0;
+  }
+
+  // the steps recorded in the last solve, and their number in *n
+  const LSODA::StepRecord* lsoda_api_recorded(void* handle, size_t* n) {
+    const std::vector<LSODA::StepRecord> &steps =
+      static_cast<LSODA::ApiHandle*>(handle)->solver.recorded();
+    *n = steps.size();
+    return steps.empty() ? nullptr : &steps[0];
+  }
+
+  int lsoda_api_set_replay(void* handle, const LSODA::StepRecord* steps, size_t n) {
+    LSODA::ApiHandle* h = static_cast<LSODA::ApiHandle*>(handle);
+    try {
+      h->solver.set_replay(std::vector<LSODA::StepRecord>(steps, steps+n));
+    } catch (std::exception &e) {
+      h->error = e.what();
+      return -1;
+    }
+    return 0;
+  }
+
+  int lsoda_api_set_output_indices(void* handle, const size_t* idx, size_t nidx) {
+    static_cast<LSODA::ApiHandle*>(handle)->solver.set_output_indices(std::vector<size_t>(idx, idx+nidx));
+    return 0;
+  }
+
+  // one call to LSODA::lsoda_function(): y (0-based, length neq) is updated in place
+  int lsoda_api_solve(void* handle, LSODA::LSODA_ODE_SYSTEM_TYPE func, size_t neq,
+		      double* y, double* t, double tout, int* istate, void* data,
+		      double rtol, double atol) {
+    LSODA::ApiHandle* h = static_cast<LSODA::ApiHandle*>(handle);
+    try {
+      std::vector<double> yin(y, y+neq), yout;
+      h->solver.lsoda_function(func, neq, yin, yout, t, tout, istate, data, rtol, atol);
+      std::copy(yout.begin(), yout.begin()+neq, y);
+    } catch (std::exception &e) {
+      h->error = e.what();
+      return -1;
+    }
+    return 0;
+  }
+
+  // LSODA::ode() with the handle's solver
+  SEXP lsoda_api_ode(void* handle, LSODA::LSODA_ODE_SYSTEM_TYPE func, size_t neq,
+		     const double* y, const double* times, size_t ntimes, size_t nout,
+		     void* data, double rtol, double atol) {
+    LSODA::ApiHandle* h = static_cast<LSODA::ApiHandle*>(handle);
+    try {
+      std::vector<double> yv(y, y+neq), timesv(times, times+ntimes);
+      return LSODA::ode(h->solver, yv, timesv, func, nout, data, rtol, atol);
+    } catch (std::exception &e) {
+      h->error = e.what();
+      return R_NilValue;
+    }
+  }
+
+  // the metrics registry of the package
+  void* lsoda_api_metrics() {
+    return (void*) &LSODA::metrics();
+  }
+
+} // extern "C"
+
+// [[Rcpp::init]]
+void lsoda_init_api(DllInfo* dll) {
+  (void) dll;
+  R_RegisterCCallable("lsoda", "lsoda_api_new", (DL_FUNC) &lsoda_api_new);
+  R_RegisterCCallable("lsoda", "lsoda_api_delete", (DL_FUNC) &lsoda_api_delete);
+  R_RegisterCCallable("lsoda", "lsoda_api_error", (DL_FUNC) &lsoda_api_error);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_jacobian", (DL_FUNC) &lsoda_api_set_jacobian);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_jacobian_blocks", (DL_FUNC) &lsoda_api_set_jacobian_blocks);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_jacobian_function", (DL_FUNC) &lsoda_api_set_jacobian_function);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_mass", (DL_FUNC) &lsoda_api_set_mass);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_broyden", (DL_FUNC) &lsoda_api_set_broyden);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_anderson", (DL_FUNC) &lsoda_api_set_anderson);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_threads", (DL_FUNC) &lsoda_api_set_threads);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_heuristics", (DL_FUNC) &lsoda_api_set_heuristics);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_derivatives", (DL_FUNC) &lsoda_api_set_derivatives);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_norm", (DL_FUNC) &lsoda_api_set_norm);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_controller", (DL_FUNC) &lsoda_api_set_controller);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_initial_step", (DL_FUNC) &lsoda_api_set_initial_step);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_output_indices", (DL_FUNC) &lsoda_api_set_output_indices);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_record", (DL_FUNC) &lsoda_api_set_record);
+  R_RegisterCCallable("lsoda", "lsoda_api_recorded", (DL_FUNC) &lsoda_api_recorded);
+  R_RegisterCCallable("lsoda", "lsoda_api_set_replay", (DL_FUNC) &lsoda_api_set_replay);
+  R_RegisterCCallable("lsoda", "lsoda_api_solve", (DL_FUNC) &lsoda_api_solve);
+  R_RegisterCCallable("lsoda", "lsoda_api_ode", (DL_FUNC) &lsoda_api_ode);
+  R_RegisterCCallable("lsoda", "lsoda_api_metrics", (DL_FUNC) &lsoda_api_metrics);
+}
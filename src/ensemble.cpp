@@ -0,0 +1,237 @@
+#include "lsoda.h"
+#include <cstdio>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/*
+  Ensembles of an R function over parameter sets, for ode_ensemble().
+  R functions cannot be called from threads, so the sets are split into
+  contiguous shards, each solved by a forked worker process.  The results
+  go straight into memory shared by all processes ( an anonymous shared
+  mapping ) of the layout of the R result array, so that nothing is
+  serialised back to the parent, which copies the mapping into the
+  result once.  Without fork() ( Windows ), or with one worker, the sets
+  are solved in turn in the R process.
+*/
+
+namespace LSODA {
+
+  // declared in unit.cpp
+  void lsoda_rfunctor_adaptor(double t, double* y, double* ydot, void* data);
+
+  namespace ensemble {
+
+    const size_t MSGLEN = 256;
+
+    // memory shared with the workers: results, statistics and status
+    struct Shared {
+      double *res = nullptr, *stats = nullptr;
+      int *status = nullptr; // per set: -1 not solved, 0 solved, 1 error
+      char *msg = nullptr;   // per set: error message, MSGLEN each
+      void *base = nullptr;
+      size_t bytes = 0;
+      std::vector<char> local;
+
+      Shared(size_t nres, size_t nsets, bool shared) {
+	bytes = (nres + 3 * nsets) * sizeof(double) + nsets * (sizeof(int) + MSGLEN);
+#ifndef _WIN32
+	if (shared) {
+	  base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	  if (base == MAP_FAILED) {
+	    base = nullptr;
+	    Rcpp::stop("ode_ensemble: cannot map " + std::to_string(bytes) + " bytes of shared memory");
+	  }
+	}
+#else
+	(void) shared;
+#endif
+	if (base == nullptr) {
+	  local.resize(bytes);
+	  base = &local[0];
+	}
+	res    = static_cast<double*>(base);
+	stats  = res + nres;
+	status = reinterpret_cast<int*>(stats + 3 * nsets);
+	msg    = reinterpret_cast<char*>(status + nsets);
+	std::fill(status, status + nsets, -1);
+	std::fill(msg, msg + nsets * MSGLEN, '\0');
+      }
+
+      ~Shared() {
+#ifndef _WIN32
+	if (local.empty() && base != nullptr)
+	  munmap(base, bytes);
+#endif
+      }
+      Shared(const Shared&) = delete;
+      Shared& operator=(const Shared&) = delete;
+    };
+
+    // sink writing one set's matrix into its slice of the results
+    struct SliceSink {
+      double *res;
+      size_t nrow, ncol;
+      void init(size_t nrow, size_t ncol) {
+	if (nrow != this->nrow || ncol != this->ncol)
+	  Rcpp::stop("the results of func do not have the same length for all parameter sets");
+      }
+      void set(size_t i, size_t j, double x) {
+	res[i + nrow * j] = x;
+      }
+      void finish(const std::vector<std::string> &nms, const std::map<std::string, double> &stats) {
+	(void) nms; (void) stats;
+      }
+    };
+
+    // solve sets first to last - 1; called in a worker or the R process
+    void solve(Shared &sh, Rcpp::Function closure, const Rcpp::NumericMatrix &y0,
+	       const std::vector<double> &times, size_t nout, double rtol, double atol,
+	       size_t first, size_t last) {
+      size_t neq = y0.ncol(), nrow = times.size(), ncol = 1 + nout;
+      for (size_t k = first; k < last; k++) {
+	try {
+	  Rcpp::Function func(closure((int) k + 1));
+	  std::tuple<Rcpp::Function,size_t,size_t> pr(func, neq, nout);
+	  std::vector<double> y(neq);
+	  for (size_t j = 0; j < neq; j++) y[j] = y0(k, j);
+	  SliceSink sink{sh.res + k * nrow * ncol, nrow, ncol};
+	  LSODA solver;
+	  ode_sink(sink, solver, y, times, lsoda_rfunctor_adaptor, nout, (void*) &pr, rtol, atol);
+	  std::map<std::string, double> stats = solver.statistics();
+	  sh.stats[3 * k]     = stats["nst"];
+	  sh.stats[3 * k + 1] = stats["nfe"];
+	  sh.stats[3 * k + 2] = stats["nje"];
+	  if (solver.failure() < 0) {
+	    std::snprintf(sh.msg + k * MSGLEN, MSGLEN, "lsoda failed with istate = %d",
+			  solver.failure());
+	    sh.status[k] = 1;
+	  } else {
+	    sh.status[k] = 0;
+	  }
+	} catch (std::exception &e) {
+	  std::snprintf(sh.msg + k * MSGLEN, MSGLEN, "%s", e.what());
+	  sh.status[k] = 1;
+	} catch (...) {
+	  std::snprintf(sh.msg + k * MSGLEN, MSGLEN, "unknown error");
+	  sh.status[k] = 1;
+	}
+      }
+    }
+
+#ifndef _WIN32
+    static void check_interrupt(void *dummy) {
+      (void) dummy;
+      R_CheckUserInterrupt();
+    }
+
+    // true if the user has interrupted, without a long jump
+    inline bool interrupted() {
+      return R_ToplevelExec(check_interrupt, nullptr) == FALSE;
+    }
+#endif
+
+  } // namespace ensemble
+
+} // namespace LSODA
+
+//' Ensemble of solutions over parameter sets (C++ code)
+//'
+//' The workhorse of \code{\link{ode_ensemble}}.
+//' @param y0 matrix of initial values, a row for each set
+//' @param times vector of times -- including the start time
+//' @param closure R function of the set index k (from 1) that returns
+//'  the function(t,y) for set k, as for \code{\link{ode_cpp}}
+//' @param rtol double for the relative tolerance
+//' @param atol double for the absolute tolerance
+//' @param workers number of worker processes
+//' @return an array with dimensions the times, the time and the states
+//'  and results values, and the sets
+//' @keywords internal
+// [[Rcpp::export]]
+Rcpp::NumericVector ode_ensemble_cpp(Rcpp::NumericMatrix y0, std::vector<double> times,
+				     Rcpp::Function closure, double rtol = 1e-6, double atol = 1e-6,
+				     int workers = 1) {
+  using namespace Rcpp;
+  using namespace LSODA::ensemble;
+  size_t nsets = y0.nrow(), neq = y0.ncol(), nrow = times.size(), k, j;
+  if (nsets == 0) Rcpp::stop("no parameter sets");
+  if (workers < 1) Rcpp::stop("workers should be >= 1");
+  Function func1(closure(1));
+  std::vector<double> y1(neq);
+  for (j = 0; j < neq; j++) y1[j] = y0(0, j);
+  List vals = as<List>(func1(times[0], y1));
+  size_t nres = (vals.size() > 1) ? (as<std::vector<double> >(vals[1])).size() : 0;
+  size_t nout = neq + nres, ncol = 1 + nout;
+  size_t nw = std::min((size_t) workers, nsets);
+#ifdef _WIN32
+  nw = 1;
+#endif
+  Shared sh(nrow * ncol * nsets, nsets, nw > 1);
+  if (nw == 1)
+    solve(sh, closure, y0, times, nout, rtol, atol, 0, nsets);
+#ifndef _WIN32
+  else {
+    std::vector<pid_t> pids;
+    for (size_t w = 0; w < nw; w++) {
+      size_t first = nsets * w / nw, last = nsets * (w + 1) / nw;
+      pid_t pid = fork();
+      if (pid == 0) {
+	solve(sh, closure, y0, times, nout, rtol, atol, first, last);
+	_exit(0);
+      }
+      if (pid < 0) { // solve this shard here
+	REprintf("ode_ensemble: fork failed, solving sets %d to %d in this process\n",
+		 (int) first + 1, (int) last);
+	solve(sh, closure, y0, times, nout, rtol, atol, first, last);
+      } else
+	pids.push_back(pid);
+    }
+    // wait for the workers ( only ours: R may have other children )
+    bool stopped = false;
+    while (!pids.empty()) {
+      for (k = pids.size(); k-- > 0;)
+	if (waitpid(pids[k], nullptr, WNOHANG) != 0)
+	  pids.erase(pids.begin() + k);
+      if (pids.empty()) break;
+      if (!stopped && interrupted()) {
+	stopped = true;
+	for (k = 0; k < pids.size(); k++) kill(pids[k], SIGKILL);
+      }
+      usleep(2000);
+    }
+    if (stopped) Rcpp::stop("ode_ensemble: interrupted");
+  }
+#endif
+  NumericVector res(nrow * ncol * nsets);
+  std::copy(sh.res, sh.res + res.size(), res.begin());
+  NumericMatrix stats(nsets, 3);
+  std::string failed;
+  size_t nfailed = 0;
+  for (k = 0; k < nsets; k++) {
+    for (j = 0; j < 3; j++) stats(k, j) = sh.stats[3 * k + j];
+    if (sh.status[k] != 0) {
+      std::fill(res.begin() + k * nrow * ncol, res.begin() + (k + 1) * nrow * ncol, NA_REAL);
+      for (j = 0; j < 3; j++) stats(k, j) = NA_REAL;
+      if (nfailed++ == 0)
+	failed = "set " + std::to_string(k + 1) + ": " +
+	  (sh.status[k] < 0 ? std::string("the worker stopped") : std::string(sh.msg + k * MSGLEN));
+    }
+  }
+  if (nfailed > 0)
+    Rcpp::warning("ode_ensemble: " + std::to_string(nfailed) + " of " + std::to_string(nsets) +
+		  " parameter sets failed (NA); the first, " + failed);
+  CharacterVector nms(ncol);
+  nms[0] = "time";
+  for (j = 0; j < nout; j++)
+    nms[j + 1] = (j < neq) ? "y" + std::to_string(j + 1) : "res" + std::to_string(j - neq + 1);
+  colnames(stats) = CharacterVector::create("nst", "nfe", "nje");
+  res.attr("dim") = IntegerVector::create(nrow, ncol, nsets);
+  res.attr("dimnames") = List::create(R_NilValue, nms, R_NilValue);
+  res.attr("stats") = stats;
+  return res;
+}
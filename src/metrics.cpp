@@ -0,0 +1,69 @@
+#include "lsoda.h"
+
+//' Metrics of the solves aggregated over the session
+//'
+//' While enabled with \code{ode_metrics_enable()}, every solve by the
+//' package (\code{\link{ode}}, \code{\link{ode_cpp}}, compiled models and
+//' inline code on lsoda_api.h) is added to a process-wide registry of
+//' lock-free counters and histograms: per solve, the steps, func
+//' evaluations, Jacobian evaluations, method switches and the wall time,
+//' and the counts of the solves and of the failures by istate (-1 excess
+//' work, -2 excess accuracy requested, -3 illegal input, -4 repeated error
+//' test failures, -5 repeated convergence failures, -6 a zero error
+//' weight).  The registry is available from C++ as \code{LSODA::metrics()}.
+//' @param reset logical: whether to clear the registry after reading it
+//' @return \code{ode_metrics} returns a data frame with a row for each
+//'  metric: its name, the count (of solves, or of the events for the
+//'  counts), the sum, mean, approximate 50th, 90th and 99th percentiles
+//'  (the upper bounds of power of 2 buckets) and maximum.
+//' @examples
+//'  old = lsoda::ode_metrics_enable()
+//'  func = function(t,y,parms) list(-y)
+//'  for (k in 1:5) lsoda::ode(1, c(0,k), func)
+//'  lsoda::ode_metrics(reset=TRUE)
+//'  lsoda::ode_metrics_enable(old)
+//' @export
+// [[Rcpp::export]]
+Rcpp::DataFrame ode_metrics(bool reset = false) {
+  using namespace Rcpp;
+  std::vector<LSODA::MetricSummary> s = LSODA::metrics().summary();
+  if (reset) LSODA::metrics().reset();
+  std::vector<std::string> metric;
+  std::vector<double> count, sum, mean, p50, p90, p99, max;
+  for (size_t k = 0; k < s.size(); k++) {
+    bool hist = k < 5;
+    metric.push_back(s[k].name);
+    count.push_back((double) s[k].count);
+    sum.push_back(hist ? (double) s[k].sum : NA_REAL);
+    mean.push_back(hist ? s[k].mean : NA_REAL);
+    p50.push_back(hist ? s[k].p50 : NA_REAL);
+    p90.push_back(hist ? s[k].p90 : NA_REAL);
+    p99.push_back(hist ? s[k].p99 : NA_REAL);
+    max.push_back(hist ? (double) s[k].max : NA_REAL);
+  }
+  return DataFrame::create(Named("metric") = metric, Named("count") = count,
+			   Named("sum") = sum, Named("mean") = mean, Named("p50") = p50,
+			   Named("p90") = p90, Named("p99") = p99, Named("max") = max,
+			   Named("stringsAsFactors") = false);
+}
+
+//' @param enable logical: whether to record the solves
+//' @return \code{ode_metrics_enable} returns whether recording was enabled
+//'  before.
+//' @rdname ode_metrics
+//' @export
+// [[Rcpp::export]]
+bool ode_metrics_enable(bool enable = true) {
+  return LSODA::metrics().enable(enable);
+}
+
+//' @param file name of the text file that the metrics and the counts in
+//'  the buckets of the histograms are appended to, with a time stamp
+//' @return \code{ode_metrics_dump} returns NULL.
+//' @rdname ode_metrics
+//' @export
+// [[Rcpp::export]]
+void ode_metrics_dump(std::string file) {
+  if (!LSODA::metrics().dump(file))
+    Rcpp::stop("ode_metrics_dump: cannot write to " + file);
+}
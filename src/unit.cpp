@@ -1,9 +1,72 @@
 #include "lsoda.h"
+#include "lsoda_model.h"
 
 void unit() {}
 
 namespace LSODA {
 
+  // the Tuner of an "lsoda_tuner" object from ode_tuner()
+  Tuner* tuner_get(SEXP x) {
+    Tuner* tuner = static_cast<Tuner*>(R_ExternalPtrAddr(x));
+    if (tuner == nullptr)
+      Rcpp::stop("the tuner is not available (was it saved and reloaded?)");
+    return tuner;
+  }
+
+  // heuristics: NULL, a named list of constants, or an "lsoda_tuner"
+  void set_heuristics(LSODA &solver, SEXP heuristics) {
+    using namespace Rcpp;
+    if (Rf_isNull(heuristics))
+      return;
+    if (Rf_inherits(heuristics, "lsoda_tuner")) {
+      solver.set_heuristics(tuner_get(heuristics)->next());
+      return;
+    }
+    if (Rf_isNull(Rf_getAttrib(heuristics, R_NamesSymbol)))
+      Rcpp::stop("heuristics should be a named list or a tuner from ode_tuner()");
+    List h(heuristics);
+    CharacterVector nms = h.names();
+    Heuristics heur;
+    for (R_xlen_t k = 0; k < h.size(); k++) {
+      std::string nm = as<std::string>(nms[k]);
+      double x = as<double>(h[k]);
+      if (nm == "ccmax") heur.ccmax = x;
+      else if (nm == "msbp") heur.msbp = (size_t) x;
+      else if (nm == "maxcor") heur.maxcor = (size_t) x;
+      else if (nm == "mxncf") heur.mxncf = (size_t) x;
+      else if (nm == "ratio") heur.ratio = x;
+      else Rcpp::stop("unknown heuristic \"" + nm + "\": should be ccmax, msbp, maxcor, mxncf or ratio");
+      if (nm != "ccmax" && nm != "ratio" && (x < 1 || x != std::floor(x)))
+	Rcpp::stop(nm + " should be a positive integer");
+    }
+    solver.set_heuristics(heur);
+  }
+
+  // steps: NULL, TRUE to record the accepted steps, or the "steps" data
+  // frame of an earlier result to replay
+  void set_steps(LSODA &solver, SEXP steps) {
+    using namespace Rcpp;
+    if (Rf_isNull(steps))
+      return;
+    if (Rf_isLogical(steps)) {
+      solver.set_record(as<bool>(steps));
+      return;
+    }
+    if (!Rf_inherits(steps, "data.frame"))
+      Rcpp::stop("steps should be TRUE or the \"steps\" attribute of an earlier result");
+    DataFrame d(steps);
+    NumericVector t = d["t"], h = d["h"];
+    IntegerVector order = d["order"];
+    CharacterVector method = d["method"];
+    std::vector<StepRecord> rec(t.size());
+    for (R_xlen_t k = 0; k < t.size(); k++) {
+      std::string m = as<std::string>(method[k]);
+      if (m != "adams" && m != "bdf") Rcpp::stop("steps: method should be \"adams\" or \"bdf\"");
+      rec[k] = StepRecord{t[k], h[k], order[k], (m == "adams") ? 1 : 2};
+    }
+    solver.set_replay(rec);
+  }
+
   void lsoda_rfunctor_adaptor(double t, double* y, double* ydot, void* data) {
     using Tuple = std::tuple<Rcpp::Function, size_t, size_t>;
     Tuple* tuple = static_cast<Tuple*>(data);
@@ -21,6 +84,142 @@ namespace LSODA {
     }
   }
 
+  // solver options shared by ode_cpp() and ode_model_cpp()
+  void set_options(LSODA &solver, size_t neq,
+		   Rcpp::Nullable<Rcpp::NumericVector> mass, std::string jacobian,
+		   Rcpp::Nullable<Rcpp::IntegerVector> bandwidth, int blocksize, int broyden,
+		   int derivatives, Rcpp::Nullable<Rcpp::IntegerVector> select, int trace,
+		   std::string norm, std::string controller, std::string initial_step,
+		   int anderson, SEXP heuristics, SEXP steps) {
+    using namespace Rcpp;
+    if (mass.isNotNull())
+      solver.set_mass(as<std::vector<double> >(mass.get()));
+    if (jacobian == "banded") {
+      if (bandwidth.isNull()) Rcpp::stop("bandwidth = c(ml, mu) is needed for a banded Jacobian");
+      std::vector<int> mlmu = as<std::vector<int> >(bandwidth.get());
+      if (mlmu.size() != 2 || mlmu[0] < 0 || mlmu[1] < 0) Rcpp::stop("bandwidth should be c(ml, mu)");
+      solver.set_jacobian(5, mlmu[0], mlmu[1]);
+    } else if (jacobian == "blockdiag") {
+      if (blocksize < 1 || neq % blocksize != 0)
+        Rcpp::stop("blocksize should divide length(y) for a block-diagonal Jacobian");
+      solver.set_jacobian_blocks(blocksize);
+    } else if (jacobian == "auto") {
+      solver.set_jacobian(6);
+    } else if (jacobian != "dense")
+      Rcpp::stop("jacobian should be one of \"dense\", \"banded\", \"blockdiag\" or \"auto\"");
+    if (broyden < 0) Rcpp::stop("broyden should be >= 0");
+    solver.set_broyden(broyden);
+    if (derivatives < 0 || derivatives > 2) Rcpp::stop("derivatives should be 0, 1 or 2");
+    solver.set_derivatives(derivatives);
+    if (select.isNotNull()) {
+      std::vector<int> sel = as<std::vector<int> >(select.get());
+      std::vector<size_t> idx;
+      for (size_t i = 0; i < sel.size(); i++) {
+        if (sel[i] < 1) Rcpp::stop("select should be positive indices");
+        idx.push_back(sel[i] - 1);
+      }
+      solver.set_output_indices(idx);
+    }
+    if (trace < 0) Rcpp::stop("trace should be >= 0");
+    solver.set_trace(trace);
+    if (norm == "rms")
+      solver.set_norm(2);
+    else if (norm != "max")
+      Rcpp::stop("norm should be \"max\" or \"rms\"");
+    if (controller == "PI")
+      solver.set_controller(2);
+    else if (controller != "classical")
+      Rcpp::stop("controller should be \"classical\" or \"PI\"");
+    if (initial_step == "hairer")
+      solver.set_initial_step(2);
+    else if (initial_step != "lsoda")
+      Rcpp::stop("initial_step should be \"lsoda\" or \"hairer\"");
+    if (anderson < 0) Rcpp::stop("anderson should be >= 0");
+    solver.set_anderson(anderson);
+    set_heuristics(solver, heuristics);
+    set_steps(solver, steps);
+  }
+
+  // the step trace as a data frame, with the number of attempts in all
+  Rcpp::DataFrame trace_frame(const LSODA &solver) {
+    using namespace Rcpp;
+    std::vector<TraceEntry> trace = solver.trace();
+    size_t k, n = trace.size();
+    NumericVector t(n), h(n);
+    IntegerVector order(n), iterations(n);
+    CharacterVector method(n), jacobian(n), outcome(n);
+    const char* methods[] = {"", "adams", "bdf"};
+    const char* jacobians[] = {"reused", "new", "broyden"};
+    const char* outcomes[] = {"accepted", "error", "convergence"};
+    for (k = 0; k < n; k++) {
+      t[k] = trace[k].t;
+      h[k] = trace[k].h;
+      order[k] = trace[k].order;
+      method[k] = methods[trace[k].method];
+      iterations[k] = trace[k].iterations;
+      jacobian[k] = jacobians[trace[k].jacobian];
+      outcome[k] = outcomes[trace[k].outcome];
+    }
+    DataFrame res = DataFrame::create(Named("t") = t, Named("h") = h, Named("order") = order,
+				      Named("method") = method, Named("iterations") = iterations,
+				      Named("jacobian") = jacobian, Named("outcome") = outcome,
+				      Named("stringsAsFactors") = false);
+    res.attr("total") = (double) solver.trace_total();
+    return res;
+  }
+
+  // the steps recorded as a data frame
+  Rcpp::DataFrame steps_frame(const LSODA &solver) {
+    using namespace Rcpp;
+    const std::vector<StepRecord> &steps = solver.recorded();
+    size_t k, n = steps.size();
+    NumericVector t(n), h(n);
+    IntegerVector order(n);
+    CharacterVector method(n);
+    const char* methods[] = {"", "adams", "bdf"};
+    for (k = 0; k < n; k++) {
+      t[k] = steps[k].t;
+      h[k] = steps[k].h;
+      order[k] = steps[k].order;
+      method[k] = methods[steps[k].method];
+    }
+    return DataFrame::create(Named("t") = t, Named("h") = h, Named("order") = order,
+			     Named("method") = method, Named("stringsAsFactors") = false);
+  }
+
+  SEXP ode_lazy(LSODA &solver, std::vector<double> y, std::vector<double> times,
+		LSODA_ODE_SYSTEM_TYPE func, size_t nout, void* data,
+		double rtol, double atol);
+
+  // ode() with the results stored as doubles, as floats for storage = "float",
+  // or interpolated on access for storage = "lazy" (src/altrep.cpp), and
+  // the step trace, if any, in the "trace" attribute, and the steps
+  // recorded in the "steps" attribute; the cost is reported to the
+  // tuner, if heuristics is one
+  SEXP ode_storage(LSODA &solver, std::string storage,
+		   std::vector<double> y, std::vector<double> times,
+		   LSODA_ODE_SYSTEM_TYPE func, size_t nout, void* data,
+		   double rtol, double atol, int trace, SEXP heuristics) {
+    Rcpp::RObject res;
+    if (storage == "float") {
+      FloatSink sink;
+      ode_sink(sink, solver, y, times, func, nout, data, rtol, atol);
+      res = sink.res;
+    } else if (storage == "lazy") {
+      res = ode_lazy(solver, y, times, func, nout, data, rtol, atol);
+    } else if (storage == "double") {
+      res = ode(solver, y, times, func, nout, data, rtol, atol);
+    } else
+      Rcpp::stop("storage should be \"double\", \"float\" or \"lazy\"");
+    if (trace > 0)
+      res.attr("trace") = trace_frame(solver);
+    if (solver.recording())
+      res.attr("steps") = steps_frame(solver);
+    if (Rf_inherits(heuristics, "lsoda_tuner"))
+      tuner_get(heuristics)->report(solver, y.size(), solver.failure());
+    return res;
+  }
+
 } // namespace LSODA
 
 //' Ordinary differential equation solver using lsoda (C++ code)
@@ -31,7 +230,101 @@ namespace LSODA {
 //'  element, if it exists, is a vector of result calculations to be retained.
 //' @param rtol double for the relative tolerance
 //' @param atol double for the absolute tolerance
+//' @param mass optional vector for the diagonal of a constant mass matrix M,
+//'  for solving the semi-explicit DAE M dy/dt = f(t,y); zero entries mark
+//'  algebraic equations 0 = f(t,y), and func then returns f rather than dy/dt.
+//' @param jacobian structure of the finite difference Jacobian for the stiff
+//'  method: "dense", "banded" (with bandwidth), "blockdiag" (with blocksize),
+//'  or "auto" to detect the sparsity pattern from func before the first step
+//'  and choose between a dense, banded or column-grouped Jacobian.  Grouping
+//'  only saves func evaluations: the Jacobian is still stored and factored
+//'  as a dense matrix.
+//' @param bandwidth integer vector c(ml, mu) of the lower and upper
+//'  half-bandwidths for jacobian = "banded".
+//' @param blocksize integer size of the uncoupled subsystems packed in y for
+//'  jacobian = "blockdiag"; the Jacobian is then computed and factored block by block.
+//' @param broyden for a dense or column-grouped Jacobian, the maximum number of
+//'  iteration matrices in a row formed from a Jacobian kept up to date by
+//'  Broyden rank-one updates instead of finite differences (0 to disable).
+//' @param derivatives number of derivatives of the states to return at
+//'  the output times: 0, 1 for dy/dt (columns dy1, dy2, ...) or 2 for also
+//'  d2y/dt2 (columns d2y1, ...).  They are interpolated from the solver's
+//'  Nordsieck array, without further calls to func; d2y/dt2 is NA at the
+//'  initial time and where it exceeds the order of the last step.
+//' @param select optional indices of the columns to return, counting the
+//'  states and then the results of func; only the selected states are
+//'  interpolated at the output times, and func is only called for the
+//'  results if one of them is selected.  Derivatives are returned for the
+//'  selected states.
+//' @param storage "double" for a matrix of results, "float" to store
+//'  them as 32-bit floats at half the memory, in an object of class
+//'  "lsoda_float" that is indexed like a matrix and expanded to doubles
+//'  only for the rows and columns extracted, or "lazy" for a matrix of the
+//'  times and states only that keeps the solver's interpolation
+//'  polynomials of each step and evaluates an element when it is read
+//'  (an ALTREP vector); the matrix is stored in full once R needs all of
+//'  it at once.  The results of func are dropped, and derivatives and
+//'  select are not available, with "lazy".
+//' @param trace number of attempted steps to record, keeping the last
+//'  ones if there are more (0 for none).  The trace is returned in the
+//'  "trace" attribute, as a data frame with the time aimed for (t), the
+//'  step size (h), the order and method ("adams" or "bdf"), the number of
+//'  corrector iterations, whether the iteration matrix was "reused" or
+//'  formed from a "new" or "broyden" updated Jacobian, and the outcome
+//'  ("accepted", or a rejection after an "error" test or "convergence"
+//'  failure); its "total" attribute is the number of attempts in all.
+//' @param norm weighted norm of the error and convergence tests: "max"
+//'  for the maximum over the components, as in the original lsoda, or
+//'  "rms" for the root mean square, as in CVODE and DASSL.  For large
+//'  systems "rms" usually takes fewer steps at the same tolerances, with
+//'  the error then controlled on average rather than in each component.
+//' @param controller step size controller: "classical", from the error
+//'  estimate of each step, or "PI", which also uses the estimate of the
+//'  previous step (Gustafsson) for a smoother step size sequence with
+//'  fewer rejected steps on oscillatory problems.
+//' @param initial_step how the first step size is chosen: "lsoda", from
+//'  the tolerance, the length of the interval and the initial dy/dt, or
+//'  "hairer", the algorithm of Hairer, Norsett and Wanner, which also
+//'  estimates the second derivative with one more call to func.  It
+//'  avoids rejected first steps where dy/dt is initially small, as when
+//'  starting from rest.
+//' @param anderson window of Anderson acceleration of the functional
+//'  iteration of the nonstiff (Adams) method, 0 for none, up to 5 (but
+//'  at most 2 has an effect with 3 corrector iterations).  It cuts
+//'  convergence failures in mildly stiff regions, and so step size
+//'  reductions and switches to the stiff method; 1 is usually best.
+//' @param heuristics NULL for the constants of the original lsoda, a
+//'  named list with any of ccmax (0.3: the relative change of h * el[1]
+//'  at which the iteration matrix is formed anew), msbp (20: the most
+//'  steps between iteration matrices), maxcor (3: the most corrector
+//'  iterations), mxncf (10: the convergence failures before the solver
+//'  stops) and ratio (5: the step size advantage to switch from Adams to
+//'  BDF), or a tuner from \code{\link{ode_tuner}} that chooses them over
+//'  repeated solves.
+//' @param steps NULL, TRUE to record the accepted steps in the "steps"
+//'  attribute, as a data frame with the time reached (t), the step size
+//'  (h), the order and the method ("adams" or "bdf"), or the "steps"
+//'  attribute of an earlier result to replay its step sequence: each step
+//'  then takes the recorded size, order and method, without the error
+//'  test.  Solves with slightly changed parameters, as for finite
+//'  difference gradients, then have no jumps from changes of the steps
+//'  and are cheaper, with the accuracy of the recorded solve.  The
+//'  corrector iterations and Jacobian evaluations still adapt, so a
+//'  replay with the recorded parameters differs from the recorded solve
+//'  by up to about the tolerance, and small jumps remain: take
+//'  differences between replays only.  If the corrector
+//'  fails to converge on a step, or the steps end before the last time,
+//'  the solve goes on adaptively; the "nrp" statistic is the number of
+//'  steps replayed.
 //' @return a matrix for times in the first column and the state andd results values in the other columns.
+//'  The "stats" attribute holds the solver statistics, including the
+//'  number of steps (nst), func evaluations (nfe) and Jacobian evaluations (nje),
+//'  and the Jacobian type used (jt: 2 for dense or column-grouped, 5 for banded,
+//'  7 for block-diagonal), its half-bandwidths (ml, mu), number of column
+//'  groups (ngroups), block size (blocksize) and number of iteration
+//'  matrices formed from a Broyden updated Jacobian (nbu), method
+//'  switches (nsw), steps replayed (nrp) and the first negative istate
+//'  returned by lsoda if the solve failed, or 0 (istate).
 //' @examples
 //'   times = c(0,0.4*10^(0:10))
 //'  y = c(1,0,0)
@@ -45,15 +338,150 @@ namespace LSODA {
 //'  lsoda::ode_cpp(y,times,func, rtol=1e-8, atol=1e-8)
 //' @export
 // [[Rcpp::export]]
-Rcpp::NumericMatrix ode_cpp(std::vector<double> y,
+SEXP ode_cpp(std::vector<double> y,
 			    std::vector<double> times,
 			    Rcpp::Function func,
-			    double rtol = 1e-6, double atol = 1e-6) {
+			    double rtol = 1e-6, double atol = 1e-6,
+			    Rcpp::Nullable<Rcpp::NumericVector> mass = R_NilValue,
+			    std::string jacobian = "dense",
+			    Rcpp::Nullable<Rcpp::IntegerVector> bandwidth = R_NilValue,
+			    int blocksize = 0, int broyden = 0, int derivatives = 0,
+			    Rcpp::Nullable<Rcpp::IntegerVector> select = R_NilValue,
+			    std::string storage = "double", int trace = 0,
+			    std::string norm = "max", std::string controller = "classical",
+			    std::string initial_step = "lsoda", int anderson = 0,
+			    SEXP heuristics = R_NilValue, SEXP steps = R_NilValue) {
   using namespace Rcpp;
   using Tuple = std::tuple<Function,size_t,size_t>;
   List vals = as<List>(func(times[0],y));
   size_t nres = (vals.size() > 1) ? (as<std::vector<double> >(vals[1])).size() : 0;
   Tuple pr = std::make_tuple(func, y.size(), y.size()+nres);
-  return LSODA::ode(y, times, LSODA::lsoda_rfunctor_adaptor, y.size()+nres,
-		    (void*) &pr, rtol, atol);
+  LSODA::LSODA solver;
+  LSODA::set_options(solver, y.size(), mass, jacobian, bandwidth, blocksize, broyden,
+		     derivatives, select, trace, norm, controller, initial_step, anderson,
+		     heuristics, steps);
+  return LSODA::ode_storage(solver, storage, y, times, LSODA::lsoda_rfunctor_adaptor,
+			    y.size()+nres, (void*) &pr, rtol, atol, trace, heuristics);
+}
+
+// solve a model compiled by ode_model(), with parms as the data pointer
+// [[Rcpp::export]]
+SEXP ode_model_cpp(std::vector<double> y,
+				  std::vector<double> times,
+				  SEXP model,
+				  std::vector<double> parms,
+				  double rtol = 1e-6, double atol = 1e-6,
+				  Rcpp::Nullable<Rcpp::NumericVector> mass = R_NilValue,
+				  std::string jacobian = "dense",
+				  Rcpp::Nullable<Rcpp::IntegerVector> bandwidth = R_NilValue,
+				  int blocksize = 0, int broyden = 0, int derivatives = 0,
+				  Rcpp::Nullable<Rcpp::IntegerVector> select = R_NilValue,
+				  std::string storage = "double", int trace = 0,
+				  std::string norm = "max", std::string controller = "classical",
+				  std::string initial_step = "lsoda", int anderson = 0,
+				  SEXP heuristics = R_NilValue, SEXP steps = R_NilValue) {
+  LSODA::Model* m = static_cast<LSODA::Model*>(R_ExternalPtrAddr(model));
+  if (m == nullptr)
+    Rcpp::stop("the compiled model is not available (was it saved and reloaded?)");
+  if (y.size() != m->neq)
+    Rcpp::stop("y has length " + std::to_string(y.size()) + " but the model has " +
+	       std::to_string(m->neq) + " states");
+  if (parms.size() != m->nparms)
+    Rcpp::stop("parms has length " + std::to_string(parms.size()) + " but the model has " +
+	       std::to_string(m->nparms) + " parameters");
+  void* data = parms.empty() ? nullptr : (void*) &parms[0];
+  LSODA::LSODA solver;
+  LSODA::set_options(solver, y.size(), mass, jacobian, bandwidth, blocksize, broyden,
+		     derivatives, select, trace, norm, controller, initial_step, anderson,
+		     heuristics, steps);
+  if (m->jac != nullptr && jacobian == "dense")
+    solver.set_jacobian_function(m->jac, data);
+  return LSODA::ode_storage(solver, storage, y, times, m->rhs, m->nout, data, rtol, atol, trace,
+			    heuristics);
+}
+
+// rows i and columns j (1-based) of a "lsoda_float" result, as doubles
+// [[Rcpp::export]]
+Rcpp::NumericMatrix lsoda_float_expand(Rcpp::RawVector x, Rcpp::IntegerVector i,
+				       Rcpp::IntegerVector j) {
+  Rcpp::IntegerVector dims = x.attr("dims");
+  size_t nrow = dims[0];
+  for (R_xlen_t r = 0; r < i.size(); r++)
+    if (i[r] == NA_INTEGER || i[r] < 1 || i[r] > dims[0]) Rcpp::stop("row index out of range");
+  for (R_xlen_t c = 0; c < j.size(); c++)
+    if (j[c] == NA_INTEGER || j[c] < 1 || j[c] > dims[1]) Rcpp::stop("column index out of range");
+  Rcpp::NumericMatrix res(i.size(), j.size());
+  float f;
+  for (R_xlen_t c = 0; c < j.size(); c++)
+    for (R_xlen_t r = 0; r < i.size(); r++) {
+      std::memcpy(&f, &x[((i[r] - 1) + nrow * (j[c] - 1)) * sizeof(float)], sizeof(float));
+      res(r, c) = f;
+    }
+  return res;
+}
+
+static void tuner_finalize(SEXP ptr) {
+  delete static_cast<LSODA::Tuner*>(R_ExternalPtrAddr(ptr));
+  R_ClearExternalPtr(ptr);
+}
+
+//' Tuner of the solver heuristics over repeated solves
+//'
+//' A tuner passed as the heuristics argument of \code{\link{ode}} sets
+//' the heuristic constants of each solve, and learns from its cost: the
+//' func evaluations (including those for finite difference Jacobians)
+//' plus jacweight for each iteration matrix formed and factored.  From
+//' the defaults, it tries the neighbouring values of ccmax, msbp, maxcor
+//' and ratio in turn, each for batch solves, and moves to one that costs
+//' at least 1\% less on average, until no neighbour is better.  A solve
+//' that fails costs Inf, so that settings that fail are not chosen.  Use one
+//' tuner for the repeated solves of one model, e.g. in an ensemble or
+//' the objective function of an optimiser.
+//' @param jacweight cost of an iteration matrix in func evaluations, or
+//'  a negative value for the number of states
+//' @param batch number of solves averaged for each setting
+//' @return an object of class "lsoda_tuner"; \code{tuner_state} gives the
+//'  best constants so far, their mean cost, whether the search has
+//'  converged, and the numbers of solves and moves.
+//' @examples
+//'  func = function(t,y,parms) {
+//'      ydot = rep(0,3)
+//'      ydot[1] = parms$k * y[2] * y[3] - .04E0 * y[1]
+//'      ydot[3] = 3.0E7 * y[2] * y[2]
+//'      ydot[2] = -1.0 * (ydot[1] + ydot[3])
+//'      list(ydot)
+//'  }
+//'  tuner = lsoda::ode_tuner()
+//'  times = c(0,0.4*10^(0:8))
+//'  for (k in seq(0.8e4, 1.2e4, length=30))
+//'      res = lsoda::ode(c(1,0,0), times, func, list(k=k), heuristics=tuner)
+//'  lsoda::tuner_state(tuner)
+//' @export
+// [[Rcpp::export]]
+SEXP ode_tuner(double jacweight = -1, int batch = 3) {
+  if (batch < 1) Rcpp::stop("batch should be >= 1");
+  SEXP ptr = PROTECT(R_MakeExternalPtr(new LSODA::Tuner(jacweight, batch), R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(ptr, tuner_finalize, TRUE);
+  Rf_setAttrib(ptr, R_ClassSymbol, Rf_mkString("lsoda_tuner"));
+  UNPROTECT(1);
+  return ptr;
+}
+
+//' @param tuner an "lsoda_tuner" object
+//' @rdname ode_tuner
+//' @export
+// [[Rcpp::export]]
+Rcpp::List tuner_state(SEXP tuner) {
+  using namespace Rcpp;
+  LSODA::Tuner* t = LSODA::tuner_get(tuner);
+  LSODA::Heuristics h = t->best();
+  return List::create(Named("best") = List::create(Named("ccmax") = h.ccmax,
+						  Named("msbp") = (double) h.msbp,
+						  Named("maxcor") = (double) h.maxcor,
+						  Named("mxncf") = (double) h.mxncf,
+						  Named("ratio") = h.ratio),
+		      Named("cost") = t->cost(),
+		      Named("converged") = t->converged(),
+		      Named("solves") = (double) t->solves(),
+		      Named("moves") = (double) t->moves());
 }
@@ -0,0 +1,232 @@
+/*
+  Heap allocations of the solver per phase.  The global operator new and
+  delete of this program are replaced by versions on malloc and free
+  that, while counting is switched on, count the allocations and the
+  bytes allocated, and follow the bytes in use for the peak.  A program's
+  own replacement is always the one bound, unlike that of a shared
+  library loaded by R.  For the Robertson ( with an extra output, through
+  func_trunc ), Van der Pol ( mu = 1000 ) and harmonic oscillator
+  problems, the phases are the first call to the solver, which allocates
+  its work space ( "init" ), the calls for the other output times (
+  "steps" ), and LSODA::ode_sink() as a whole ( "ode" ), which also
+  stores the results, in a VectorSink: the Rcpp matrix of LSODA::ode()
+  needs a running R.  The test fails if any "steps" phase allocates, or if an
+  "init" phase counts nothing ( the counting is not in effect ).
+*/
+
+#include "lsoda.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#if defined(__GLIBC__) || defined(_WIN32)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#endif
+
+namespace alloc {
+
+  std::atomic<bool> counting(false);
+  std::atomic<long long> count(0), bytes(0), current(0), peak(0);
+
+  inline long long block_size(void* p, std::size_t size) {
+#if defined(__GLIBC__)
+    (void) size;
+    return (long long) malloc_usable_size(p);
+#elif defined(__APPLE__)
+    (void) size;
+    return (long long) malloc_size(p);
+#elif defined(_WIN32)
+    (void) size;
+    return (long long) _msize(p);
+#else
+    (void) p;
+    return (long long) size;
+#endif
+  }
+
+  inline void allocated(void* p, std::size_t size) {
+    long long n = block_size(p, size);
+    count++;
+    bytes += n;
+    long long now = (current += n), top = peak.load();
+    while (now > top && !peak.compare_exchange_weak(top, now)) {}
+  }
+
+  inline void freed(void* p) {
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(_WIN32)
+    current -= block_size(p, 0);
+#else
+    (void) p;
+#endif
+  }
+
+  inline void* allocate(std::size_t size) {
+    void* p = std::malloc(size ? size : 1);
+    if (p != nullptr && counting.load(std::memory_order_relaxed))
+      allocated(p, size);
+    return p;
+  }
+
+  inline void release(void* p) {
+    if (p != nullptr && counting.load(std::memory_order_relaxed))
+      freed(p);
+    std::free(p);
+  }
+
+  // counts for one phase
+  struct Phase {
+    long long count, bytes, peak;
+  };
+
+  inline void begin() {
+    count = 0;
+    bytes = 0;
+    current = 0;
+    peak = 0;
+    counting = true;
+  }
+
+  inline Phase end() {
+    counting = false;
+    Phase phase = {count.load(), bytes.load(), peak.load()};
+    return phase;
+  }
+
+} // namespace alloc
+
+void* operator new(std::size_t size) {
+  void* p = alloc::allocate(size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](std::size_t size) {
+  void* p = alloc::allocate(size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return alloc::allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return alloc::allocate(size);
+}
+
+void operator delete(void* p) noexcept {
+  alloc::release(p);
+}
+
+void operator delete[](void* p) noexcept {
+  alloc::release(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  alloc::release(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+  alloc::release(p);
+}
+
+// standard problems, with an extra output for robertson to go through func_trunc
+void robertson(double t, double* y, double* ydot, void* data) {
+  (void) t; (void) data;
+  ydot[0] = 1.0E4 * y[1] * y[2] - .04E0 * y[0];
+  ydot[2] = 3.0E7 * y[1] * y[1];
+  ydot[1] = -1.0 * (ydot[0] + ydot[2]);
+  ydot[3] = y[0] + y[1] + y[2];
+}
+
+void vanderpol(double t, double* y, double* ydot, void* data) {
+  (void) t; (void) data;
+  ydot[0] = y[1];
+  ydot[1] = 1000. * (1. - y[0] * y[0]) * y[1] - y[0];
+}
+
+void oscillator(double t, double* y, double* ydot, void* data) {
+  (void) t; (void) data;
+  ydot[0] = y[1];
+  ydot[1] = -y[0];
+}
+
+struct Problem {
+  const char* name;
+  LSODA::LSODA_ODE_SYSTEM_TYPE func;
+  std::vector<double> y, times;
+  size_t nout;
+};
+
+std::vector<Problem> problems() {
+  std::vector<Problem> res;
+  std::vector<double> times;
+  times.push_back(0.);
+  for (int k = 0; k <= 10; k++) times.push_back(0.4 * std::pow(10., k));
+  res.push_back(Problem{"robertson", robertson, {1., 0., 0.}, times, 4});
+  times.clear();
+  for (int k = 0; k <= 30; k++) times.push_back(100. * k);
+  res.push_back(Problem{"vanderpol", vanderpol, {2., 0.}, times, 2});
+  times.clear();
+  for (int k = 0; k <= 100; k++) times.push_back(0.5 * k);
+  res.push_back(Problem{"oscillator", oscillator, {0., 1.}, times, 2});
+  return res;
+}
+
+int main() {
+  const double rtol = 1e-8, atol = 1e-8;
+  std::vector<Problem> probs = problems();
+  int failures = 0;
+  std::printf("%-10s %-5s %6s %11s %9s %9s\n", "problem", "phase", "steps", "allocations",
+	      "bytes", "peak");
+  for (size_t p = 0; p < probs.size(); p++) {
+    Problem &pr = probs[p];
+    size_t neq = pr.y.size();
+    LSODA::TruncTuple tuple = LSODA::func_trunc_data(pr.func, neq, pr.nout, nullptr);
+    LSODA::LSODA_ODE_SYSTEM_TYPE func = (pr.nout > neq) ? LSODA::func_trunc : pr.func;
+    void* data = (pr.nout > neq) ? (void*) &tuple : nullptr;
+    LSODA::LSODA solver;
+    std::vector<double> yin(pr.y), yout(neq);
+    double t = pr.times[0];
+    int istate = 1;
+    alloc::begin();
+    solver.lsoda_function(func, neq, yin, yout, &t, pr.times[1], &istate, data, rtol, atol);
+    alloc::Phase init = alloc::end();
+    double nst0 = solver.statistics()["nst"];
+    yin = yout;
+    alloc::begin();
+    for (size_t i = 2; i < pr.times.size() && istate > 0; i++) {
+      solver.lsoda_function(func, neq, yin, yout, &t, pr.times[i], &istate, data, rtol, atol);
+      yin = yout;
+    }
+    alloc::Phase stepping = alloc::end();
+    double nst1 = solver.statistics()["nst"];
+    LSODA::LSODA solver2;
+    LSODA::VectorSink sink;
+    alloc::begin();
+    LSODA::ode_sink(sink, solver2, pr.y, pr.times, pr.func, pr.nout, nullptr, rtol, atol);
+    alloc::Phase whole = alloc::end();
+    alloc::Phase phases[] = {init, stepping, whole};
+    const char* names[] = {"init", "steps", "ode"};
+    double nsteps[] = {nst0, nst1 - nst0, solver2.statistics()["nst"]};
+    for (int k = 0; k < 3; k++)
+      std::printf("%-10s %-5s %6.0f %11lld %9lld %9lld\n", pr.name, names[k], nsteps[k],
+		  phases[k].count, phases[k].bytes, phases[k].peak);
+    if (istate < 0 || solver2.failure() < 0) {
+      std::printf("%s: istate = %d, %d for ode\n", pr.name, istate, solver2.failure());
+      failures++;
+    }
+    if (init.count == 0) {
+      std::printf("%s: no allocations counted in init\n", pr.name);
+      failures++;
+    }
+    if (stepping.count > 0) {
+      std::printf("%s: %lld allocations in %.0f steps\n", pr.name, stepping.count, nst1 - nst0);
+      failures++;
+    }
+  }
+  return failures > 0;
+}
@@ -0,0 +1,66 @@
+/*
+  One solver reused for a problem with a column-grouped Jacobian
+  ( jt = 6 ) and then, after set_defaults(), for a dense problem of
+  another size: the sparsity
+  pattern and column groups of the first solve should not be used.
+*/
+
+#include "lsoda.h"
+#include <cmath>
+#include <cstdio>
+
+// dy[i]/dt = y[i-1] - 2 y[i] + y[i+1] on a ring of 30 states
+void ring(double t, double *y, double *ydot, void *data) {
+  (void) t; (void) data;
+  const int n = 30;
+  for(int i = 0; i < n; i++)
+    ydot[i] = y[(i + n - 1) % n] - 2. * y[i] + y[(i + 1) % n];
+}
+
+void robertson(double t, double *y, double *ydot, void *data) {
+  (void) t; (void) data;
+  ydot[0] = 1.0E4 * y[1] * y[2] - .04E0 * y[0];
+  ydot[2] = 3.0E7 * y[1] * y[1];
+  ydot[1] = -1.0 * (ydot[0] + ydot[2]);
+}
+
+// y at tout from t = 0, with a new solver or the one given
+std::vector<double> solve(LSODA::LSODA &solver, LSODA::LSODA_ODE_SYSTEM_TYPE f,
+			  std::vector<double> y, double tout, int &istate) {
+  std::vector<double> yout(y.size());
+  double t = 0.;
+  istate = 1;
+  solver.lsoda_function(f, y.size(), y, yout, &t, tout, &istate, nullptr, 1e-8, 1e-10);
+  return yout;
+}
+
+int main() {
+  int failures = 0, istate;
+  std::vector<double> y0(30, 0.);
+  y0[0] = 1.;
+
+  LSODA::LSODA solver;
+  solver.set_jacobian(6);
+  solve(solver, ring, y0, 10., istate);
+  if(istate < 0 || solver.statistics()["ngroups"] == 0) {
+    std::printf("ring: istate = %d, ngroups = %g\n", istate, solver.statistics()["ngroups"]);
+    failures++;
+  }
+
+  LSODA::LSODA fresh;
+  std::vector<double> ref = solve(fresh, robertson, {1., 0., 0.}, 40., istate);
+  solver.set_defaults();
+  std::vector<double> y = solve(solver, robertson, {1., 0., 0.}, 40., istate);
+  if(istate < 0 || solver.statistics()["ngroups"] != 0 || solver.jacobian_type() != "dense") {
+    std::printf("robertson after ring: istate = %d, ngroups = %g, jacobian %s\n", istate,
+		solver.statistics()["ngroups"], solver.jacobian_type().c_str());
+    failures++;
+  }
+  for(size_t i = 0; i < 3; i++)
+    if(y[i] != ref[i]) {
+      std::printf("robertson after ring: y%d = %.10g, with a new solver %.10g\n",
+		  (int) i + 1, y[i], ref[i]);
+      failures++;
+    }
+  return failures > 0;
+}